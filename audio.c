@@ -140,9 +140,6 @@ extern Int64_t __cdecl _ftelli64(FILE *);
 	#define FTELL64		ftello
 #endif
 
-/* Global */
-Int64_t current_pos_t;
-
 #if (defined (WIN32) || defined (_WIN32))
 __inline long int lrint(double flt)
 {
@@ -595,6 +592,7 @@ int aiff_open(FILE *in, wavegain_opt *opt, unsigned char *buf,
 		opt->rate = format.rate;
 		opt->channels = format.channels;
 		opt->read_samples = wav_read; /* Similar enough, so we use the same */
+		opt->read_analysis = wav_read_analysis;
 		opt->total_samples_per_channel = format.totalframes;
 		opt->samplesize = format.samplesize;
 		if (aifc && format.samplesize == 8)
@@ -613,6 +611,10 @@ int aiff_open(FILE *in, wavegain_opt *opt, unsigned char *buf,
 		opt->readdata = (void *)aiff;
 
 		seek_forward(in, format.offset); /* Swallow some data */
+		if (!opt->std_in) {
+			aiff->datastart = FTELL64(in);
+			opt->seek_samples = wav_seek;
+		}
 		return 1;
 	}
 	else {
@@ -719,7 +721,7 @@ int wav_open(FILE *in, wavegain_opt *opt,
 
 	if (opt->apply_gain) {
 		current_pos = FTELL64(in);
-		current_pos_t = current_pos + len;
+		opt->data_end = current_pos + len;
 		FSEEK64(in, 0, SEEK_SET);
 		if ((opt->header = malloc(sizeof(char) * current_pos)) == NULL)
 			fprintf(stderr, "Error: unable to allocate memory for header\n");
@@ -734,31 +736,30 @@ int wav_open(FILE *in, wavegain_opt *opt,
 	if(format.format == WAVE_FORMAT_PCM) {
 		samplesize = format.samplesize/8;
 		opt->read_samples = wav_read;
+		opt->read_analysis = wav_read_analysis;
 		/* works with current enum */
 		opt->format = samplesize;
 	}
 	else if(format.format == WAVE_FORMAT_IEEE_FLOAT) {
 		samplesize = 4;
 		opt->read_samples = wav_ieee_read;
+		opt->read_analysis = wav_ieee_read_analysis;
 		opt->endianness = LITTLE;
 		opt->format = WAV_FMT_FLOAT;
 	}
 	else if (format.format == WAVE_FORMAT_EXTENSIBLE) {
 		format.channel_mask = READ_U32_LE(buf+20);
-		if (format.channel_mask > 3) {
-			fprintf(stderr, "ERROR: Wav file is unsupported type (must be standard 1 or 2 channel PCM\n"
-					" or type 3 floating point PCM)(2)\n");
-			return 0;
-		}	
 		if (memcmp(buf+24, pcm_guid, 16) == 0) {
 			samplesize = format.samplesize/8;
 			opt->read_samples = wav_read;
+			opt->read_analysis = wav_read_analysis;
 			/* works with current enum */
 			opt->format = samplesize;
 		}
 		else if (memcmp(buf+24, ieee_float_guid, 16) == 0) {
 			samplesize = 4;
 			opt->read_samples = wav_ieee_read;
+			opt->read_analysis = wav_ieee_read_analysis;
 			opt->endianness = LITTLE;
 			opt->format = WAV_FMT_FLOAT;
 		}
@@ -815,6 +816,14 @@ int wav_open(FILE *in, wavegain_opt *opt,
 			}
 		}
 		wav->totalsamples = opt->total_samples_per_channel;
+		/* A stream written before its length was known gives 0xFFFFFFFF,
+		 * read it to the end instead (see --monitor) */
+		if (opt->std_in && len == 0xffffffff)
+			wav->totalsamples = 0;
+		if (!opt->std_in) {
+			wav->datastart = FTELL64(in);
+			opt->seek_samples = wav_seek;
+		}
 
 		opt->readdata = (void *)wav;
 		return 1;
@@ -826,12 +835,28 @@ int wav_open(FILE *in, wavegain_opt *opt,
 	}
 }
 
+/* Read up to samples (per channel) of raw data into buf; returns the number read */
+static long wav_fill(wavfile *f, void *buf, int samples, int sampbyte)
+{
+	long bytes_read;
+	long realsamples;
+
+	bytes_read = fread(buf, 1, samples * sampbyte * f->channels, f->f);
+
+	if (f->totalsamples && f->samplesread + bytes_read / (sampbyte * f->channels) > f->totalsamples) {
+		bytes_read = sampbyte * f->channels * (f->totalsamples - f->samplesread);
+	}
+
+	realsamples = bytes_read / (sampbyte * f->channels);
+	f->samplesread += realsamples;
+	return realsamples;
+}
+
 long wav_read(void *in, double **buffer, int samples, int fast, int chunk)
 {
 	wavfile *f = (wavfile *)in;
 	int sampbyte = f->samplesize / 8;
 	signed char *buf = alloca(samples*sampbyte*f->channels);
-	long bytes_read;
 	int i, j;
 	long realsamples;
 
@@ -841,15 +866,8 @@ long wav_read(void *in, double **buffer, int samples, int fast, int chunk)
 		FSEEK64(f->f, chunk, SEEK_SET);
 	}
 
-	bytes_read = fread(buf, 1, samples * sampbyte * f->channels, f->f);
-
-	if (f->totalsamples && f->samplesread + bytes_read / (sampbyte * f->channels) > f->totalsamples) {
-		bytes_read = sampbyte * f->channels * (f->totalsamples - f->samplesread);
-	}
+	realsamples = wav_fill(f, buf, samples, sampbyte);
 
-	realsamples = bytes_read / (sampbyte * f->channels);
-	f->samplesread += realsamples;
-		
 	if (f->samplesize == 8) {
 		unsigned char *bufu = (unsigned char *)buf;
 		for (i = 0; i < realsamples; i++) {
@@ -931,7 +949,6 @@ long wav_ieee_read(void *in, double **buffer, int samples, int fast, int chunk)
 {
 	wavfile *f = (wavfile *)in;
 	float *buf = alloca(samples * 4 * f->channels); /* de-interleave buffer */
-	long bytes_read;
 	int i,j;
 	long realsamples;
 
@@ -941,12 +958,7 @@ long wav_ieee_read(void *in, double **buffer, int samples, int fast, int chunk)
 		FSEEK64(f->f, chunk, SEEK_SET);
 	}
 
-	bytes_read = fread(buf, 1, samples * 4 * f->channels, f->f);
-
-	if (f->totalsamples && f->samplesread + bytes_read / (4 * f->channels) > f->totalsamples)
-		bytes_read = 4 * f->channels * (f->totalsamples - f->samplesread);
-	realsamples = bytes_read / (4 * f->channels);
-	f->samplesread += realsamples;
+	realsamples = wav_fill(f, buf, samples, 4);
 
 	for (i = 0; i < realsamples; i++)
 		for (j = 0; j < f->channels; j++)
@@ -955,6 +967,134 @@ long wav_ieee_read(void *in, double **buffer, int samples, int fast, int chunk)
 	return realsamples;
 }
 
+/* The integer samples of one channel of buf (stride bytes apart, with hi the
+ * offset of the top byte), as wav_read() reads them, converted for the
+ * analyzer: with scale = 0x7fff / full scale, s * scale rounds the same way as
+ * s / full scale * 0x7fff does, both steps of that being exact but the last.
+ * Returns the sum of the samples, which is kept as an integer: the sum of the
+ * converted samples is exact as well (for less than 2^30 samples at full
+ * scale), so dividing it by full scale gives the same offset. *top is raised
+ * to the largest absolute sample.
+ */
+static __inline Int64_t convert_channel(const unsigned char *buf, int bytes, int hi, long stride,
+                               long samples, double scale, double *out, long *top)
+{
+	Int64_t sum = 0;
+	long    max = *top,
+	        s,
+	        i;
+
+	for (i = 0; i < samples; i++, buf += stride) {
+		if (bytes == 1)
+			s = (long)buf[0] - 128;
+		else if (bytes == 2)
+			s = (signed char)buf[hi] * 256L + buf[1 - hi];
+		else
+			s = (signed char)buf[2] * 65536L + buf[1] * 256L + buf[0];
+		out[i] = s * scale;
+		sum += s;
+		if ((s < 0 ? -s : s) > max)
+			max = s < 0 ? -s : s;
+	}
+	*top = max;
+	return sum;
+}
+
+long wav_read_analysis(void *in, double **buffer, int samples, double *offset, double *peak)
+{
+	wavfile *f = (wavfile *)in;
+	int sampbyte = f->samplesize / 8;
+	unsigned char *buf;
+	double full;
+	long realsamples, top = 0;
+	int i, j, native;
+
+#ifdef __APPLE__
+	native = f->bigendian != machine_endianness;
+#else
+	native = f->bigendian == machine_endianness;
+#endif
+	if (f->samplesize == 32 || (f->samplesize == 24 && !native)) {
+		/* Sums of these need not be exact, so add them up one by one */
+		realsamples = wav_read(in, buffer, samples, 0, 0);
+		for (j = 0; j < f->channels; j++) {
+			for (i = 0; i < realsamples; i++) {
+				offset[j] += buffer[j][i];
+				buffer[j][i] *= 0x7fff;
+				if (fabs(buffer[j][i]) > *peak)
+					*peak = fabs(buffer[j][i]);
+			}
+		}
+		return realsamples;
+	}
+
+	buf = alloca(samples * sampbyte * f->channels);
+	realsamples = wav_fill(f, buf, samples, sampbyte);
+	full = sampbyte == 1 ? 128.0 : sampbyte == 2 ? 32768.0 : 8388608.0;
+
+	/* Each case a call of its own, for the compiler to make the most of */
+	for (j = 0; j < f->channels; j++) {
+		const unsigned char *p = buf + j * sampbyte;
+		long  stride = sampbyte * f->channels;
+		Int64_t sum;
+
+		if (sampbyte == 1)
+			sum = convert_channel(p, 1, 0, stride, realsamples, 0x7fff / 128.0, buffer[j], &top);
+		else if (sampbyte == 2 && native)
+			sum = convert_channel(p, 2, 1, stride, realsamples, 0x7fff / 32768.0, buffer[j], &top);
+		else if (sampbyte == 2)
+			sum = convert_channel(p, 2, 0, stride, realsamples, 0x7fff / 32768.0, buffer[j], &top);
+		else
+			sum = convert_channel(p, 3, 0, stride, realsamples, 0x7fff / 8388608.0, buffer[j], &top);
+		offset[j] += sum / full;
+	}
+	if (top * (0x7fff / full) > *peak)
+		*peak = top * (0x7fff / full);
+
+	return realsamples;
+}
+
+long wav_ieee_read_analysis(void *in, double **buffer, int samples, double *offset, double *peak)
+{
+	wavfile *f = (wavfile *)in;
+	float *buf = alloca(samples * 4 * f->channels);
+	long realsamples;
+	int i, j;
+
+	realsamples = wav_fill(f, buf, samples, 4);
+
+	for (j = 0; j < f->channels; j++) {
+		double sum = offset[j],
+		       max = *peak;
+
+		for (i = 0; i < realsamples; i++) {
+			double s = buf[i * f->channels + j];
+
+			sum += s;
+			buffer[j][i] = s * 0x7fff;
+			if (fabs(buffer[j][i]) > max)
+				max = fabs(buffer[j][i]);
+		}
+		offset[j] = sum;
+		*peak = max;
+	}
+
+	return realsamples;
+}
+
+
+int wav_seek(void *in, unsigned long sample)
+{
+	wavfile *f = (wavfile *)in;
+
+	if (f->totalsamples && sample > f->totalsamples)
+		return -1;
+	if (FSEEK64(f->f, f->datastart + (Int64_t)sample * (f->samplesize / 8) * f->channels, SEEK_SET) != 0)
+		return -1;
+	f->samplesread = sample;
+	return 0;
+}
+
 
 void wav_close(void *info)
 {
@@ -983,6 +1123,7 @@ int raw_open(FILE *in, wavegain_opt *opt)
 	wav->totalsamples =  0;
 
 	opt->read_samples = wav_read;
+	opt->read_analysis = wav_read_analysis;
 	opt->readdata = (void *)wav;
 	opt->total_samples_per_channel = 0; /* raw mode, don't bother */
 	return 1;
@@ -1033,10 +1174,56 @@ audio_file *open_output_audio_file(char *infile, wavegain_opt *opt)
 			}
 			break;
 	}
+	aufile->data_start = opt->std_out ? 0 : FTELL64(aufile->sndfile);
 
 	return aufile;
 }
 
+/*
+ * Open another stream on an output file created by open_output_audio_file(),
+ * positioned on sample (per channel) of the data, so that several parts of the
+ * data can be written at the same time. The header must have been flushed.
+ */
+audio_file *open_output_audio_range(const char *outfile, const audio_file *aufile, unsigned long sample)
+{
+	audio_file *range = malloc(sizeof(audio_file));
+
+	if (range == NULL)
+		return NULL;
+
+	*range = *aufile;
+	range->samples = 0;
+	range->sndfile = fopen(outfile, "r+b");
+
+	if (range->sndfile == NULL ||
+	    FSEEK64(range->sndfile, aufile->data_start
+	            + (Int64_t)sample * aufile->channels * (aufile->bits_per_sample / 8), SEEK_SET) != 0) {
+		if (range->sndfile)
+			fclose(range->sndfile);
+		free(range);
+		return NULL;
+	}
+
+	return range;
+}
+
+void close_output_audio_range(audio_file *range)
+{
+	fclose(range->sndfile);
+	free(range);
+}
+
+/*
+ * Account for the samples (per channel) written through open_output_audio_range(),
+ * and move to the end of the data, ready for close_audio_file().
+ */
+void end_output_audio_ranges(audio_file *aufile, unsigned long samples)
+{
+	aufile->samples = samples * aufile->channels;
+	FSEEK64(aufile->sndfile, aufile->data_start
+	        + (Int64_t)aufile->samples * (aufile->bits_per_sample / 8), SEEK_SET);
+}
+
 int write_audio_file(audio_file *aufile, void *sample_buffer, int samples)
 {
 	switch (aufile->outputFormat) {
@@ -1077,13 +1264,13 @@ void close_audio_file( FILE *in, audio_file *aufile, wavegain_opt *opt)
 			case WAV_FMT_FLOAT: {
 				FSEEK64(in, 0, SEEK_END);
 				pos = FTELL64 (in);
-				if ((pos - current_pos_t) > 0) {
-					FSEEK64 (in, current_pos_t, SEEK_SET);
-					ch = malloc (sizeof(char) * (pos - current_pos_t));
+				if ((pos - opt->data_end) > 0) {
+					FSEEK64 (in, opt->data_end, SEEK_SET);
+					ch = malloc (sizeof(char) * (pos - opt->data_end));
 
-					if (fread (ch, 1, pos - current_pos_t, in) < (pos - current_pos_t))
+					if (fread (ch, 1, pos - opt->data_end, in) < (pos - opt->data_end))
 						fprintf(stderr, "Warning: Failed to read input audio file when closing output file\n");
-					fwrite (ch, pos - current_pos_t, 1, aufile->sndfile);
+					fwrite (ch, pos - opt->data_end, 1, aufile->sndfile);
 
 					if (ch)
 						free (ch);
@@ -1149,10 +1336,16 @@ int write_wav_header(audio_file *aufile, wavegain_opt *opt, Int64_t file_size)
 		}
 		if (!memcmp(p, "fmt ", 4)) {
 			unsigned long fmt_length = 0;
+			int extensible;
 			p += 4;
 			sz_fmt = READ_U32_LE(p);
 			p += 4;
-			if (aufile->outputFormat == WAV_FMT_FLOAT) {
+			/* Extensible headers stay extensible, to keep the channel mask */
+			extensible = sz_fmt >= 40 && READ_U16_LE(p) == WAVE_FORMAT_EXTENSIBLE;
+			if (extensible) {
+				WRITE_U16(p, WAVE_FORMAT_EXTENSIBLE);
+			}
+			else if (aufile->outputFormat == WAV_FMT_FLOAT) {
 				WRITE_U16(p, 3);
 			}
 			else {
@@ -1175,6 +1368,11 @@ int write_wav_header(audio_file *aufile, wavegain_opt *opt, Int64_t file_size)
 			WRITE_U16(p, samplesize);
 			p += 2;
 			fmt_length += 2;
+			if (extensible) {
+				/* Valid bits and sub-format, after the extension size */
+				WRITE_U16(p + 2, samplesize);
+				memcpy(p + 8, aufile->outputFormat == WAV_FMT_FLOAT ? ieee_float_guid : pcm_guid, 16);
+			}
 			p += sz_fmt - fmt_length;
 			no_of_chunks_processed++;
 		}
@@ -1401,7 +1599,7 @@ int write_audio_24bit(audio_file *aufile, void *sample_buffer, unsigned int samp
 {
 	int          ret;
 	unsigned int i;
-	long         *sample_buffer24 = (long*)sample_buffer;
+	int          *sample_buffer24 = (int*)sample_buffer;
 	char         *data = malloc(samples*aufile->bits_per_sample*sizeof(char)/8);
 
 	aufile->samples += samples;
@@ -1424,7 +1622,7 @@ int write_audio_32bit(audio_file *aufile, void *sample_buffer, unsigned int samp
 {
 	int          ret;
 	unsigned int i;
-	long         *sample_buffer32 = (long*)sample_buffer;
+	int          *sample_buffer32 = (int*)sample_buffer;
 	char         *data = malloc(samples*aufile->bits_per_sample*sizeof(char)/8);
 
 	aufile->samples += samples;
@@ -55,9 +55,23 @@ typedef long (*audio_read_func)(void *src,
                                 int fast,
                                 int chunk);
 
+/* Reads like audio_read_func, and in the same pass adds the samples of each
+ * channel to offset, scales them by 0x7fff for the analyzer and raises peak
+ * to the largest scaled sample, as read_analysis_block() in wavegain.c does */
+typedef long (*audio_analysis_func)(void *src,
+                                    double **buffer,
+                                    int samples,
+                                    double *offset,
+                                    double *peak);
+
+/* Moves the next read to sample (per channel) of the data; returns 0 if successful */
+typedef int (*audio_seek_func)(void *src, unsigned long sample);
+
 typedef struct
 {
 	audio_read_func read_samples;
+	audio_seek_func seek_samples;	/* NULL if the input can't seek */
+	audio_analysis_func read_analysis;	/* NULL if the input has none */
 	
 	void *readdata;
 
@@ -77,6 +91,7 @@ typedef struct
 	int undo;
 	int header_size;
 	unsigned char *header;
+	Int64_t data_end;	/* Position of the first byte after the data chunk */
 
 	FILE *out;
 	char *filename;
@@ -110,6 +125,7 @@ typedef struct {
 	unsigned long  samplesread;
 	FILE  *f;
 	short bigendian;
+	Int64_t datastart;
 } wavfile;
 
 typedef struct {
@@ -135,6 +151,9 @@ void raw_close(void *);
 
 long wav_read(void *, double **buffer, int samples, int fast, int chunk);
 long wav_ieee_read(void *, double **buffer, int samples, int fast, int chunk);
+long wav_read_analysis(void *, double **buffer, int samples, double *offset, double *peak);
+long wav_ieee_read_analysis(void *, double **buffer, int samples, double *offset, double *peak);
+int wav_seek(void *, unsigned long sample);
 
 enum file_formats {
 	WAV_NO_FMT = 0,
@@ -158,11 +177,15 @@ typedef struct
 	unsigned long samples;
 	int           endianness;
 	int           format;
+	Int64_t       data_start;
 } audio_file;
 
 audio_file *open_output_audio_file(char *infile, wavegain_opt *opt);
 int write_audio_file(audio_file *aufile, void *sample_buffer, int samples);
 void close_audio_file(FILE *in, audio_file *aufile, wavegain_opt *opt);
+audio_file *open_output_audio_range(const char *outfile, const audio_file *aufile, unsigned long sample);
+void close_output_audio_range(audio_file *range);
+void end_output_audio_ranges(audio_file *aufile, unsigned long samples);
 int write_wav_header(audio_file *aufile, wavegain_opt *opt, Int64_t file_size);
 int write_aiff_header(audio_file *aufile);
 int write_audio_8bit(audio_file *aufile, void *sample_buffer, unsigned int samples);
@@ -6,6 +6,17 @@
 /* Enable recursive processing and pattern matching */
 #define ENABLE_RECURSIVE
 
+/* Enable processing several files at once, with --threads */
+#define ENABLE_THREADS
+
+/* Use AVX2 or AVX-512 analysis filters on processors that have them */
+#define ENABLE_AVX
+
+/* Use the block (look-ahead) versions of those filters; faster on processors
+   with two 512-bit multiply-add units, slower on most others. Off unless
+   built with -DENABLE_BLOCK_FILTERS, as 'make check' also tests them. */
+//#define ENABLE_BLOCK_FILTERS
+
 /* Define if you have the <dirent.h> header file, and it defines `DIR'. */
 #undef HAVE_DIRENT_H
 
@@ -21,10 +21,6 @@ static const  unsigned char    Parity [256] = {  // parity
 	1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0
 };
 
-static unsigned int  __r1 = 1;
-static unsigned int  __r2 = 1;
-
-
 /*
  *  This is a simple random number generator with good quality for audio purposes.
  *  It consists of two polycounters with opposite rotation direction and different
@@ -50,34 +46,37 @@ static unsigned int  __r2 = 1;
  *  The first has an period of 3*5*17*257*65537, the second of 7*47*73*178481,
  *  which gives a period of 18.410.713.077.675.721.215. The result is the
  *  XORed values of both generators.
+ *
+ *  The generator state is kept in the dither_t, so every file being written
+ *  gets its own reproducible random sequence.
  */
 
 
 unsigned int
-random_int ( void )
+random_int ( dither_t* d )
 {
 	unsigned int  t1, t2, t3, t4;
 
-	t3   = t1 = __r1;   t4   = t2 = __r2;       // Parity calculation is done via table lookup, this is also available
+	t3   = t1 = d->r1;  t4   = t2 = d->r2;      // Parity calculation is done via table lookup, this is also available
 	t1  &= 0xF5;        t2 >>= 25;              // on CPUs without parity, can be implemented in C and avoid unpredictable
 	t1   = Parity [t1]; t2  &= 0x63;            // jumps and slow rotate through the carry flag operations.
 	t1 <<= 31;          t2   = Parity [t2];
 
-	return (__r1 = (t3 >> 1) | t1 ) ^ (__r2 = (t4 + t4) | t2 );
+	return (d->r1 = (t3 >> 1) | t1 ) ^ (d->r2 = (t4 + t4) | t2 );
 }
 
 
 
 double
-Random_Equi ( double mult )                     // gives a equal distributed random number
+Random_Equi ( dither_t* d, double mult )        // gives a equal distributed random number
 {                                               // between -2^31*mult and +2^31*mult
-	return mult * (int) random_int ();
+	return mult * (int) random_int ( d );
 }
 
 double
-Random_Triangular ( double mult )               // gives a triangular distributed random number
+Random_Triangular ( dither_t* d, double mult )  // gives a triangular distributed random number
 {                                               // between -2^32*mult and +2^32*mult
-	return mult * ( (double) (int) random_int () + (double) (int) random_int () );
+	return mult * ( (double) (int) random_int ( d ) + (double) (int) random_int ( d ) );
 }
 
 /*********************************************************************************************************************/
@@ -159,7 +158,7 @@ scalar16 ( const float* x, const float* y )
 
 
 void
-Init_Dither ( int bits, int shapingtype )
+Init_Dither ( dither_t* d, int bits, int shapingtype )
 {
 	static unsigned char    default_dither [] = { 92, 92, 88, 84, 81, 78, 74, 67,  0,  0 };
 	static const float*                  F [] = { F44_0, F44_1, F44_2, F44_3 };
@@ -171,13 +170,29 @@ Init_Dither ( int bits, int shapingtype )
 	if (index < 0) index = 0;
 	if (index > 9) index = 9;
 
-	memset ( Dither.ErrorHistory , 0, sizeof (Dither.ErrorHistory ) );
-	memset ( Dither.DitherHistory, 0, sizeof (Dither.DitherHistory) );
+	memset ( d->ErrorHistory , 0, sizeof (d->ErrorHistory ) );
+	memset ( d->DitherHistory, 0, sizeof (d->DitherHistory) );
+	memset ( d->LastRandomNumber, 0, sizeof (d->LastRandomNumber) );
+
+	d->FilterCoeff = F [shapingtype];
+	d->Mask   = ((Uint64_t)-1) << (32 - bits);
+	d->Add    = 0.5     * ((1L << (32 - bits)) - 1);
+	d->Dither = 0.01*default_dither[index] / (((Int64_t)1) << bits);
+	d->r1     = 1;
+	d->r2     = 1;
+}
 
-	Dither.FilterCoeff = F [shapingtype];
-	Dither.Mask   = ((Uint64_t)-1) << (32 - bits);
-	Dither.Add    = 0.5     * ((1L << (32 - bits)) - 1);
-	Dither.Dither = 0.01*default_dither[index] / (((Int64_t)1) << bits);
+
+// Starts another random sequence, so parts of a file can be dithered independently.
+// Seed 0 gives the sequence Init_Dither() starts with.
+
+void
+Seed_Dither ( dither_t* d, unsigned int seed )
+{
+	d->r1 = seed * 2654435761u + 1;             // neither generator may be all zeros
+	d->r2 = seed * 2246822519u + 1;
+	if ( d->r1 == 0 ) d->r1 = 1;
+	if ( d->r2 == 0 ) d->r2 = 1;
 }
 
 
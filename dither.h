@@ -22,19 +22,19 @@ typedef struct {
 	Uint64_t      Mask;
 	double        Add;
 	float         Dither;
-	float         ErrorHistory     [2] [16];       // max. 2 channels, 16th order Noise shaping
-	float         DitherHistory    [2] [16];
-	int           LastRandomNumber [2];
+	float         ErrorHistory     [MAX_CHANNELS] [16];     // 16th order Noise shaping
+	float         DitherHistory    [MAX_CHANNELS] [16];
+	int           LastRandomNumber [MAX_CHANNELS];
+	unsigned int  r1, r2;                          // random number generator state
 } dither_t;
 
-extern dither_t            Dither;
-extern double              doubletmp;
 static const unsigned char Parity [256];
-unsigned int               random_int ( void );
+unsigned int               random_int ( dither_t* d );
 extern double              scalar16 ( const float* x, const float* y );
-extern double              Random_Equi ( double mult );
-extern double              Random_Triangular ( double mult );
-void                       Init_Dither ( int bits, int shapingtype );
+extern double              Random_Equi ( dither_t* d, double mult );
+extern double              Random_Triangular ( dither_t* d, double mult );
+void                       Init_Dither ( dither_t* d, int bits, int shapingtype );
+void                       Seed_Dither ( dither_t* d, unsigned int seed );
 
 #ifdef __cplusplus
 }
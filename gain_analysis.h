@@ -37,18 +37,55 @@
 #define INIT_GAIN_ANALYSIS_ERROR      0
 #define INIT_GAIN_ANALYSIS_OK         1
 
+#define GAIN_BATCH_MAX                8     // most analyzers AnalyzeSamplesBatch() takes at once
+#define GAIN_MAX_CHANNELS             8     // most channels AnalyzeChannelsCtx() takes
+
+#define GAIN_HISTOGRAM_WINDOWS        0     // histograms of GetTitleHistogramCtx(): the RMS windows
+#define GAIN_HISTOGRAM_BLOCKS         1     // the loudness gating blocks, see SetLoudnessCtx()
+#define GAIN_HISTOGRAM_SHORT          2     // the short-term loudness blocks
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef double  Float_t;         // Type used for filtering
 
+typedef struct gain_analysis_t  gain_analysis_t;    // Opaque analyzer state
+
 int     InitGainAnalysis ( long samplefreq );
 int     AnalyzeSamples   ( const Float_t* left_samples, const Float_t* right_samples, size_t num_samples, int num_channels );
 int		ResetSampleFrequency ( long samplefreq );
 Float_t   GetTitleGain     ( void );
 Float_t   GetAlbumGain     ( void );
 
+gain_analysis_t*  CreateGainAnalysis  ( long samplefreq );
+void      DestroyGainAnalysis     ( gain_analysis_t* ctx );
+int       InitGainAnalysisCtx     ( gain_analysis_t* ctx, long samplefreq );
+int       AnalyzeSamplesCtx       ( gain_analysis_t* ctx, const Float_t* left_samples, const Float_t* right_samples, size_t num_samples, int num_channels );
+int       AnalyzeChannelsCtx      ( gain_analysis_t* ctx, const Float_t* const* samples, size_t num_samples, int num_channels );
+int       ResetSampleFrequencyCtx ( gain_analysis_t* ctx, long samplefreq );
+Float_t   GetTitleGainCtx         ( gain_analysis_t* ctx );
+Float_t   GetAlbumGainCtx         ( gain_analysis_t* ctx );
+int       MergeGainAnalysis       ( gain_analysis_t* album_ctx, const gain_analysis_t* ctx );
+long      GetSampleWindowCtx      ( const gain_analysis_t* ctx );
+void      DiscardTitleGainCtx     ( gain_analysis_t* ctx );
+int       MergeTitleGainAnalysis  ( gain_analysis_t* title_ctx, const gain_analysis_t* ctx );
+void      SetSinglePrecisionCtx   ( gain_analysis_t* ctx, int single );
+void      SetPreviewCtx           ( gain_analysis_t* ctx, int preview );
+int       SetChannelWeightsCtx    ( gain_analysis_t* ctx, const Float_t* weights, int num_weights );
+size_t    GetTitleWindowGainsCtx  ( const gain_analysis_t* ctx, Float_t* gains, size_t max_gains );
+int       SetTitleWindowLimitCtx  ( gain_analysis_t* ctx, size_t windows );
+Float_t   PeekTitleGainCtx        ( const gain_analysis_t* ctx );
+void      SetTruePeakCtx          ( gain_analysis_t* ctx, int true_peak );
+Float_t   GetTruePeakCtx          ( const gain_analysis_t* ctx );
+int       SetLoudnessCtx          ( gain_analysis_t* ctx, int loudness );
+Float_t   GetTitleLoudnessCtx     ( const gain_analysis_t* ctx, Float_t* range );
+Float_t   GetAlbumLoudnessCtx     ( const gain_analysis_t* ctx, Float_t* range );
+size_t    GetTitleHistogramCtx    ( const gain_analysis_t* ctx, int which, unsigned int* steps, unsigned int* counts, size_t max );
+int       AddTitleHistogramCtx    ( gain_analysis_t* ctx, int which, const unsigned int* steps, const unsigned int* counts, size_t num_steps );
+int       GetAnalysisLanes        ( void );
+int       AnalyzeSamplesBatch     ( gain_analysis_t** ctx, const Float_t* const* left_samples, const Float_t* const* right_samples, int count, size_t num_samples );
+
 #ifdef __cplusplus
 }
 #endif
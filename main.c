@@ -30,6 +30,7 @@
 #include "wavegain.h"
 #include "main.h"
 #include "dither.h"
+#include "threads.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -72,10 +73,6 @@ static FILE_LIST* alloc_node(const char* file)
 		if (node->filename != NULL) {
 			node->track_peak = NO_PEAK;
 			node->track_gain = NO_GAIN;
-			node->dc_offset[0] = 0.;
-			node->dc_offset[1] = 0.;
-			node->offset[0] = 0.;
-			node->offset[1] = 0.;
 			return node;
 		}
 		free(node);
@@ -147,6 +144,381 @@ const char* ftos(double f, const char* format)
 	return s_floatToAscii;
 }
 
+/** One file to analyze on a worker thread, see analyze_files() */
+typedef struct analysis_job
+{
+	FILE_LIST*        file;
+	SETTINGS*         settings;
+	gain_analysis_t** analyzers;       /**< batch analyzers per worker thread */
+	double*           album_dc_offset;
+	int               threads;         /**< Threads the file may be split over */
+	int               batch;           /**< Files analyzed together from this one on, 0 if
+	                                        an earlier job analyzes this file */
+	int               result;
+} analysis_job;
+
+
+static void analyze_job(void* arg, int worker)
+{
+	analysis_job*    job = (analysis_job*) arg;
+	gain_analysis_t** analyzers = job->analyzers + worker * GAIN_BATCH_MAX;
+	FILE_LIST*       files[GAIN_BATCH_MAX];
+	int              results[GAIN_BATCH_MAX];
+	int              i;
+
+	if (job->batch == 1)
+		job->result = analyze_gain(job->file, analyzers[0], job->settings, job->threads);
+	else if (job->batch > 1) {
+		for (i = 0; i < job->batch; i++)
+			files[i] = job[i].file;
+		analyze_gains(files, analyzers, job->batch, job->settings, results);
+		for (i = 0; i < job->batch; i++)
+			job[i].result = results[i];
+	}
+}
+
+
+static void analysis_done(void* arg)
+{
+	analysis_job* job = (analysis_job*) arg;
+	FILE_LIST*    file = job->file;
+	int           dc;
+	int           i;
+
+	if (!job->result) {
+		file->filename = NULL;
+		return;
+	}
+	report_gain(file, job->settings);
+
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		dc = (int)(file->dc_offset[i] * 32768 * -1);
+		if (dc < -1 || dc > 1)
+			job->settings->need_to_process = 1;
+		job->album_dc_offset[i] += file->offset[i];
+	}
+}
+
+
+/**
+ * \brief Analyze the files in file_list.
+ *
+ * Analyze the files in file_list, using up to settings->threads threads.
+ * When there are fewer files than threads, long files are split up so the
+ * spare threads can help. When there are several files per thread and the
+ * processor has the vector units for it, each thread analyzes a few files
+ * side by side (see analyze_gains()). Results are printed in list order,
+ * whatever order the files are analyzed in. Files that couldn't be analyzed
+ * get their filename set to NULL.
+ *
+ * In album mode, each worker adds the files it analyzes to the album data of
+ * its own analyzers; these are summed up at the end. The album histogram is
+ * made of counters, so the album gain doesn't depend on how the files were
+ * spread over the workers.
+ *
+ * \param file_list        list of files to analyze.
+ * \param settings         settings and global variables.
+ * \param album_dc_offset  receives the sum of the DC offsets of all files.
+ * \param album_gain       receives the album gain, if settings->audiophile.
+ * \param album_loudness   receives the album loudness and loudness range, if
+ *                         settings->audiophile and settings->loudness.
+ * \return  0 if successful and -1 if an error occured (in which case a
+ *          message has been printed).
+ */
+static int analyze_files(FILE_LIST* file_list, SETTINGS* settings, double* album_dc_offset,
+                         double* album_gain, double* album_loudness)
+{
+	gain_analysis_t* analyzers[MAX_THREADS * GAIN_BATCH_MAX];
+	analysis_job*    jobs;
+	FILE_LIST*       file;
+	int              njobs = 0,
+	                 threads,
+	                 batch,
+	                 result = -1,
+	                 i, k;
+
+	for (file = file_list; file; file = file->next_file)
+		if (file->filename != NULL)
+			njobs++;
+
+	threads = settings->threads;
+	if (threads > njobs)
+		threads = njobs;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	/* Files a thread analyzes side by side; fast and estimate modes skip
+	 * through files, and the single precision filters and preview mode take one file at a
+	 * time anyway, so those are analyzed one at a time */
+	batch = njobs / threads;
+	if (batch > GetAnalysisLanes())
+		batch = GetAnalysisLanes();
+	if (batch < 1 || settings->fast || settings->estimate > 0. || settings->single
+	    || settings->preview)
+		batch = 1;
+
+	memset(analyzers, 0, sizeof(analyzers));
+	jobs = calloc(njobs + 1, sizeof(*jobs));
+	for (i = 0; i < threads && jobs != NULL; i++) {
+		for (k = 0; k < batch; k++)
+			if ((analyzers[i * GAIN_BATCH_MAX + k] = CreateGainAnalysis(0)) == NULL)
+				break;
+			else {
+				SetSinglePrecisionCtx(analyzers[i * GAIN_BATCH_MAX + k], settings->single);
+				SetPreviewCtx(analyzers[i * GAIN_BATCH_MAX + k], settings->preview);
+				SetChannelWeightsCtx(analyzers[i * GAIN_BATCH_MAX + k],
+				                     settings->num_weights ? settings->weights : NULL, settings->num_weights);
+				SetTruePeakCtx(analyzers[i * GAIN_BATCH_MAX + k], settings->true_peak);
+				if (SetLoudnessCtx(analyzers[i * GAIN_BATCH_MAX + k], settings->loudness) != GAIN_ANALYSIS_OK)
+					break;
+			}
+		if (k < batch)
+			break;
+	}
+	if (i < threads) {
+		fprintf(stderr, _("Out of memory\n"));
+		goto exit;
+	}
+
+	for (i = 0, file = file_list; file; file = file->next_file) {
+		if (file->filename == NULL)
+			continue;
+		jobs[i].file = file;
+		jobs[i].settings = settings;
+		jobs[i].analyzers = analyzers;
+		jobs[i].album_dc_offset = album_dc_offset;
+		/* Spare threads go to splitting up long files */
+		jobs[i].threads = settings->threads / threads;
+		/* Every batch-th job analyzes the files of the next ones too */
+		jobs[i].batch = (i % batch) ? 0 : (njobs - i < batch ? njobs - i : batch);
+		i++;
+	}
+
+	run_jobs(threads, jobs, njobs, sizeof(*jobs), analyze_job, analysis_done);
+
+	if (settings->audiophile) {
+		for (i = 1; i < MAX_THREADS * GAIN_BATCH_MAX; i++)
+			if (analyzers[i] && MergeGainAnalysis(analyzers[0], analyzers[i]) != GAIN_ANALYSIS_OK) {
+				fprintf(stderr, _("Out of memory\n"));
+				goto exit;
+			}
+		*album_gain = GetAlbumGainCtx(analyzers[0]);
+		if (settings->loudness) {
+			Float_t range;
+
+			album_loudness[0] = GetAlbumLoudnessCtx(analyzers[0], &range);
+			album_loudness[1] = range;
+		}
+	}
+	result = 0;
+
+exit:
+	for (i = 0; i < MAX_THREADS * GAIN_BATCH_MAX; i++)
+		if (analyzers[i])
+			DestroyGainAnalysis(analyzers[i]);
+	free(jobs);
+	return result;
+}
+
+
+/**
+ * \brief List the gains of preview mode against those of a full analysis.
+ *
+ * Analyze the files in file_list twice more, once in preview mode and once
+ * at their full sample rate, and print the track gains found each way and
+ * the difference, and the album gains in album mode. Clipping prevention and
+ * the manual gain are left out, so these are the gains as analyzed. Files at
+ * 48000Hz and below give the same gains either way. Standard input can't be
+ * read twice, and is left out.
+ *
+ * \param file_list  list of files to analyze.
+ * \param settings   settings and global variables.
+ */
+static void compare_preview(FILE_LIST* file_list, const SETTINGS* settings)
+{
+	gain_analysis_t* analyzers[2];
+	SETTINGS         compare[2];
+	FILE_LIST        copy;
+	FILE_LIST*       file;
+	double           gains[2];
+	int              i;
+
+	for (i = 0; i < 2; i++) {
+		compare[i] = *settings;
+		compare[i].preview = i;
+		compare[i].clip_prev = 0;
+		compare[i].man_gain = 0.;
+		/* Only the gains are compared, and the sidecars are those of the main analysis */
+		compare[i].true_peak = 0;
+		compare[i].loudness = 0;
+		compare[i].histogram = 0;
+		if ((analyzers[i] = CreateGainAnalysis(0)) != NULL) {
+			SetSinglePrecisionCtx(analyzers[i], settings->single);
+			SetPreviewCtx(analyzers[i], i);
+			SetChannelWeightsCtx(analyzers[i], settings->num_weights ? settings->weights : NULL,
+			                     settings->num_weights);
+		}
+	}
+	if (analyzers[0] == NULL || analyzers[1] == NULL) {
+		fprintf(stderr, _("Out of memory\n"));
+		goto exit;
+	}
+
+	fprintf(stderr, " Preview analysis against full rate analysis...\n\n");
+	fprintf(stderr, " Full rate |  Preview  | Difference| Track\n");
+	fprintf(stderr, " --------------------------------------------------------------\n");
+	if(write_to_log) {
+		write_log(" Preview analysis against full rate analysis...\n\n");
+		write_log(" Full rate |  Preview  | Difference| Track\n");
+		write_log(" --------------------------------------------------------------\n");
+	}
+	for (file = file_list; file; file = file->next_file) {
+		if (file->filename == NULL || !strcmp(file->filename, "-"))
+			continue;
+		for (i = 0; i < 2; i++) {
+			copy = *file;
+			if (!analyze_gain(&copy, analyzers[i], &compare[i], settings->threads))
+				break;
+			gains[i] = copy.track_gain;
+		}
+		if (i < 2)
+			continue;
+		fprintf(stderr, " %+6.2lf dB | %+6.2lf dB | %+6.2lf dB | %s\n",
+			gains[0], gains[1], gains[1] - gains[0], file->filename);
+		if(write_to_log)
+			write_log(" %+6.2lf dB | %+6.2lf dB | %+6.2lf dB | %s\n",
+				gains[0], gains[1], gains[1] - gains[0], file->filename);
+	}
+	if (settings->audiophile) {
+		gains[0] = GetAlbumGainCtx(analyzers[0]);
+		gains[1] = GetAlbumGainCtx(analyzers[1]);
+		fprintf(stderr, " %+6.2lf dB | %+6.2lf dB | %+6.2lf dB | Album\n",
+			gains[0], gains[1], gains[1] - gains[0]);
+		if(write_to_log)
+			write_log(" %+6.2lf dB | %+6.2lf dB | %+6.2lf dB | Album\n",
+				gains[0], gains[1], gains[1] - gains[0]);
+	}
+	fprintf(stderr, "\n");
+	if(write_to_log)
+		write_log("\n");
+
+exit:
+	for (i = 0; i < 2; i++)
+		if (analyzers[i])
+			DestroyGainAnalysis(analyzers[i]);
+}
+
+
+/** One file to write on a worker thread, see apply_files() */
+typedef struct apply_job
+{
+	FILE_LIST*        file;
+	SETTINGS*         settings;
+	double            audiophile_gain;
+	double*           album_dc_offset;
+	int               threads;         /**< Threads the file may be split over */
+	int               skip;            /**< No gain or DC offset to apply */
+	int               result;
+} apply_job;
+
+
+static void apply_job_run(void* arg, int worker __attribute__((unused)))
+{
+	apply_job* job = (apply_job*) arg;
+	FILE_LIST* file = job->file;
+
+	if (job->skip)
+		job->result = 1;
+	else if (job->settings->undo)
+		job->result = write_gains(file->filename, 0, 0, 0, 0, 0, job->settings, job->threads);
+	else
+		job->result = write_gains(file->filename, file->track_gain, job->audiophile_gain,
+		                          file->track_peak, file->dc_offset, job->album_dc_offset,
+		                          job->settings, job->threads);
+}
+
+
+static void apply_done(void* arg)
+{
+	apply_job* job = (apply_job*) arg;
+	FILE_LIST* file = job->file;
+
+	if (job->skip) {
+		fprintf(stderr, " No Title Gain adjustment or DC Offset correction required for file: %s, skipping.\n", file->filename);
+		if(write_to_log)
+			write_log(" No Title Gain adjustment or DC Offset correction required for file: %s, skipping.\n", file->filename);
+	}
+	else if (!job->result)
+		fprintf(stderr, " Error processing GAIN for file - %s\n", file->filename);
+}
+
+
+/**
+ * \brief Write (or undo) the gain of the files in file_list.
+ *
+ * Write the gain of the files in file_list, using up to settings->threads
+ * threads (one when writing to stdout). When there are fewer files than
+ * threads, long files are written in ranges by the spare threads. Dither
+ * sequences depend only on the position in the file, so the output doesn't
+ * depend on the number of threads. Skipped files and errors are reported in
+ * list order.
+ *
+ * \param file_list        list of files to write.
+ * \param settings         settings and global variables.
+ * \param audiophile_gain  album gain to apply, if settings->audiophile.
+ * \param album_dc_offset  album DC offset, if settings->adc.
+ * \return  0 if successful and -1 if an error occured (in which case a
+ *          message has been printed).
+ */
+static int apply_files(FILE_LIST* file_list, SETTINGS* settings, double audiophile_gain,
+                       double* album_dc_offset)
+{
+	apply_job* jobs;
+	FILE_LIST* file;
+	int        njobs = 0,
+	           threads,
+	           i;
+
+	for (file = file_list; file; file = file->next_file)
+		if (file->filename != NULL)
+			njobs++;
+
+	/* Files written to stdout must not be mixed up */
+	threads = settings->std_out ? 1 : settings->threads;
+	if (threads > njobs)
+		threads = njobs;
+	if (threads < 1)
+		threads = 1;
+
+	if ((jobs = calloc(njobs + 1, sizeof(*jobs))) == NULL) {
+		fprintf(stderr, _("Out of memory\n"));
+		return -1;
+	}
+
+	for (i = 0, file = file_list; file; file = file->next_file) {
+		if (file->filename == NULL)
+			continue;
+		jobs[i].file = file;
+		jobs[i].settings = settings;
+		jobs[i].audiophile_gain = audiophile_gain;
+		jobs[i].album_dc_offset = album_dc_offset;
+		/* Spare threads go to splitting up long files */
+		jobs[i].threads = settings->std_out ? 1 : settings->threads / threads;
+		jobs[i].skip = !settings->undo && settings->radio
+		               && (file->track_gain < 0.1 && file->track_gain > -0.1)
+		               && !settings->need_to_process;
+		i++;
+	}
+
+	run_jobs(threads, jobs, njobs, sizeof(*jobs), apply_job_run, apply_done);
+
+	free(jobs);
+	return 0;
+}
+
+
 /**
  * \brief Processs the file in file_list.
  *
@@ -160,13 +532,15 @@ const char* ftos(double f, const char* format)
  */
 int process_files(FILE_LIST* file_list, SETTINGS* settings, const char* dir __attribute__((unused)))
 {
-	FILE_LIST* file;
 	double     factor_clip,
 	           audiophile_gain = 0.,
+	           album_gain = 0.,
+	           album_loudness[2] = {0.},
 	           Gain,
 	           scale,
 	           dB,
-	           album_dc_offset[2] = {0., 0.};
+	           album_dc_offset[MAX_CHANNELS] = {0.};
+	int        i;
 
 	settings->album_peak = NO_PEAK;
 
@@ -175,40 +549,32 @@ int process_files(FILE_LIST* file_list, SETTINGS* settings, const char* dir __at
 
 	settings->first_file = 1;
 
+	/* Follow the gain of each file as it goes instead */
+	if (settings->monitor > 0.) {
+		int result = 0;
+
+		for (; file_list != NULL; file_list = file_list->next_file)
+			if (!monitor_gain(file_list, settings))
+				result = -1;
+		return result;
+	}
+
 	/* Undo previously applied gain */
 	if (settings->undo) {
-		for (file = file_list; file; file = file->next_file) {
-			if (file->filename == NULL)
-				continue;
-			if (!write_gains(file->filename, 0, 0, 0, 0, 0, settings)) {
-				fprintf(stderr, " Error processing GAIN for file - %s\n", file->filename);
-				continue;
-			}
-		}
+		if (apply_files(file_list, settings, 0, NULL) < 0)
+			return -1;
 	}
 	else {
-		/* Analyze the files */
-		for (file = file_list; file; file = file->next_file) {
-			int dc_l;
-			int dc_r;
-			if (file->filename == NULL)
-				continue;
-
-			if (!get_gain(file->filename, &file->track_peak, &file->track_gain,
-			              file->dc_offset, file->offset, settings)) {
-				file->filename = NULL;
-				continue;
-			}
-			dc_l = (int)(file->dc_offset[0] * 32768 * -1);
-			dc_r = (int)(file->dc_offset[1] * 32768 * -1);
-			if (dc_l < -1 || dc_l > 1 || dc_r < -1 || dc_r > 1)
-				settings->need_to_process = 1;
-			album_dc_offset[0] += file->offset[0];
-			album_dc_offset[1] += file->offset[1];
+		/* Analyze the files, or add up their histograms */
+		if (settings->merge) {
+			if (merge_histograms(file_list, settings, &album_gain, album_loudness) < 0)
+				return -1;
 		}
+		else if (analyze_files(file_list, settings, album_dc_offset, &album_gain, album_loudness) < 0)
+			return -1;
 
-		album_dc_offset[0] /= total_samples;
-		album_dc_offset[1] /= total_samples;
+		for (i = 0; i < MAX_CHANNELS; i++)
+			album_dc_offset[i] /= total_samples;
 
 		if (!settings->no_offset && settings->adc) {
 			int dc_l = (int)(album_dc_offset[0] * 32768 * -1);
@@ -226,7 +592,7 @@ int process_files(FILE_LIST* file_list, SETTINGS* settings, const char* dir __at
 			write_log("\n");
 
 		if (settings->audiophile) {
-			Gain = GetAlbumGain() + settings->man_gain;
+			Gain = album_gain + settings->man_gain;
 			scale = pow(10., Gain * 0.05);
 			settings->set_album_gain = 0;
 			if(settings->clip_prev) {
@@ -246,6 +612,20 @@ int process_files(FILE_LIST* file_list, SETTINGS* settings, const char* dir __at
 			else
 				dB = 0.0;
 			audiophile_gain = dB;
+			if (settings->merge) {
+				fprintf(stderr, " Album Peak: %6.0lf\tNew Peak: %6.0lf\n", settings->album_peak,
+					settings->album_peak * scale);
+				if(write_to_log)
+					write_log(" Album Peak: %6.0lf\tNew Peak: %6.0lf\n", settings->album_peak,
+						settings->album_peak * scale);
+			}
+			if (settings->loudness) {
+				if (album_loudness[0] == GAIN_NOT_ENOUGH_SAMPLES)
+					album_loudness[0] = -HUGE_VAL;
+				fprintf(stderr, " Album Loudness: %5.1f LUFS\tRange: %4.1f LU\n", album_loudness[0], album_loudness[1]);
+				if(write_to_log)
+					write_log(" Album Loudness: %5.1f LUFS\tRange: %4.1f LU\n", album_loudness[0], album_loudness[1]);
+			}
 			if (audiophile_gain < 0.1 && audiophile_gain > -0.1 && !settings->need_to_process) {
 				fprintf(stderr, " No Album Gain adjustment or DC Offset correction required, exiting.\n");
 				if(write_to_log)
@@ -259,24 +639,14 @@ int process_files(FILE_LIST* file_list, SETTINGS* settings, const char* dir __at
 			}
 		}
 
-		if(settings->apply_gain) {	/* Write radio and audiophile gains. */
+		if (settings->preview_compare)
+			compare_preview(file_list, settings);
+
+		/* Write radio and audiophile gains. */
+		if(settings->apply_gain && !(settings->audiophile && settings->set_album_gain == 1)) {
 			total_files = 0.0;
-			for (file = file_list; file; file = file->next_file) {
-				if (file->filename == NULL)
-					continue;
-				if (settings->audiophile && settings->set_album_gain == 1)
-					break;
-				if (settings->radio && (file->track_gain < 0.1 && file->track_gain > -0.1) && !settings->need_to_process) {
-					fprintf(stderr, " No Title Gain adjustment or DC Offset correction required for file: %s, skipping.\n", file->filename);
-					if(write_to_log)
-						write_log(" No Title Gain adjustment or DC Offset correction required for file: %s, skipping.\n", file->filename);
-				}
-				else if (!write_gains(file->filename, file->track_gain,	audiophile_gain, file->track_peak, 
-						      file->dc_offset, album_dc_offset, settings)) {
-						fprintf(stderr, " Error processing GAIN for file - %s\n", file->filename);
-						continue;
-				}
-			}
+			if (apply_files(file_list, settings, audiophile_gain, album_dc_offset) < 0)
+				return -1;
 		}
 	}
 
@@ -341,6 +711,39 @@ int process_files(FILE_LIST* file_list, SETTINGS* settings, const char* dir __at
 }
 
 
+/**
+ * \brief Read the --channel-weights list.
+ *
+ * \param list      comma separated weights, one per channel.
+ * \param settings  receives the weights.
+ * \return 1 if the list is valid: up to MAX_CHANNELS weights, none negative
+ *         and not all 0. Otherwise 0, and settings is left as it was.
+ */
+static int parse_weights(const char* list, SETTINGS* settings)
+{
+	double weights[MAX_CHANNELS];
+	double total = 0.;
+	char*  end;
+	int    n = 0;
+
+	do {
+		if (n == MAX_CHANNELS)
+			return 0;
+		weights[n] = strtod(list, &end);
+		if (end == list || !(weights[n] >= 0.))
+			return 0;
+		total += weights[n++];
+		list = end + 1;
+	} while (*end == ',');
+	if (*end != '\0' || total <= 0.)
+		return 0;
+
+	memcpy(settings->weights, weights, n * sizeof(*weights));
+	settings->num_weights = n;
+	return 1;
+}
+
+
 /**
  * Print out a list of options and the command line syntax.
  */
@@ -406,7 +809,46 @@ static void usage(void)
 	fprintf(stdout, "                         real samples, or less, will be analysed in full.\n");
 	fprintf(stdout, "                         DC Offset is neither calculated nor corrected in\n");
 	fprintf(stdout, "                         FAST mode.\n");
+	fprintf(stdout, "      --estimate X Estimates the track gain from blocks of the file picked\n");
+	fprintf(stdout, "                   at random until it is known to within X dB (at 95%%\n");
+	fprintf(stdout, "                   confidence), e.g. 0.1. Files under about a minute long\n");
+	fprintf(stdout, "                   are analysed in full. DC Offset is not calculated.\n");
+	fprintf(stdout, "                   The peak is only that of the blocks read, so the\n");
+	fprintf(stdout, "                   gain is NOT APPLIED, even with '-y'.\n");
+	fprintf(stdout, "      --monitor N  Follows the track gain of the input as it is read, e.g.\n");
+	fprintf(stdout, "                   a live stream on stdin ('-'). Every second (or every\n");
+	fprintf(stdout, "                   S seconds with '--interval S') writes the time and the\n");
+	fprintf(stdout, "                   gain of the last N seconds to stdout. DOES NOT APPLY IT.\n");
 	fprintf(stdout, "  -o, --stdout     Write output file to stdout.\n");
+	fprintf(stdout, "      --threads N  Process up to N files at the same time, where N = 0\n");
+	fprintf(stdout, "                   uses one thread per processor. DEFAULT is 1.\n");
+	fprintf(stdout, "      --single     Analyze in single precision. About twice as fast on\n");
+	fprintf(stdout, "                   processors with AVX2, gains may differ by 0.01dB.\n");
+	fprintf(stdout, "      --preview    Analyze files at 88200Hz and up at 44100Hz or 48000Hz.\n");
+	fprintf(stdout, "                   Filters half the samples or less, gains may differ by a\n");
+	fprintf(stdout, "                   few tenths of a dB if there is much above 20kHz.\n");
+	fprintf(stdout, "      --preview-compare\n");
+	fprintf(stdout, "                   Same as '--preview', then lists the gains of a preview\n");
+	fprintf(stdout, "                   and of a full analysis of each file side by side.\n");
+	fprintf(stdout, "      --channel-weights W1,W2,...\n");
+	fprintf(stdout, "                   How much each channel counts towards the loudness, in\n");
+	fprintf(stdout, "                   file order. DEFAULT is the same for all. E.g. use\n");
+	fprintf(stdout, "                   1,1,1,0,1.41,1.41 for 5.1 to leave out the LFE channel\n");
+	fprintf(stdout, "                   and count the surround channels 1.5dB up.\n");
+	fprintf(stdout, "      --true-peak  Use the true (inter-sample) peak, found by 4x\n");
+	fprintf(stdout, "                   oversampling, for Clipping Prevention and the Peak\n");
+	fprintf(stdout, "                   columns, so the files do not clip once converted.\n");
+	fprintf(stdout, "      --loudness   Also measures the integrated loudness (LUFS) and the\n");
+	fprintf(stdout, "                   loudness range (LU) of each file after EBU R128 /\n");
+	fprintf(stdout, "                   ITU-R BS.1770, in the same pass, and lists them under\n");
+	fprintf(stdout, "                   its gain. DOES NOT CHANGE THE GAIN.\n");
+	fprintf(stdout, "      --histogram  Writes the loudness histograms of each file to a\n");
+	fprintf(stdout, "                   sidecar file named after it with '.wgh' added, for\n");
+	fprintf(stdout, "                   '--merge' to work out album gains from later.\n");
+	fprintf(stdout, "                   Not with '--fast' or '--estimate'.\n");
+	fprintf(stdout, "      --merge      The files are '.wgh' sidecars, e.g. written on several\n");
+	fprintf(stdout, "                   machines: adds them up and prints the track gains and\n");
+	fprintf(stdout, "                   the album gain and peak without reading any audio.\n");
 	fprintf(stdout, " FORMAT OPTIONS (One option ONLY may be used)\n");
 	fprintf(stdout, "  -b, --bits X     Set output sample format, where X =\n");
 	fprintf(stdout, "             1     for        8 bit unsigned PCM data.\n");
@@ -427,9 +869,10 @@ static void usage(void)
 #endif
 	fprintf(stdout, " INPUT FILES\n");
 	fprintf(stdout, "  WaveGain input files may be 8, 16, 24 or 32 bit integer, or floating point\n"); 
-	fprintf(stdout, "  wave files with 1 or 2 channels and a sample rate of 96000Hz, 88200Hz,\n");
-	fprintf(stdout, "  64000Hz, 48000Hz, 44100Hz, 32000Hz, 24000Hz, 22050Hz, 16000Hz, 12000Hz,\n");
-	fprintf(stdout, "  11025Hz or 8000Hz.\n");
+	fprintf(stdout, "  wave files with 1 to 8 channels and a sample rate from 4000Hz to 384000Hz.\n");
+	fprintf(stdout, "  Rates other than 96000Hz, 88200Hz, 64000Hz, 48000Hz, 44100Hz, 32000Hz,\n");
+	fprintf(stdout, "  24000Hz, 22050Hz, 16000Hz, 12000Hz, 11025Hz and 8000Hz are analyzed\n");
+	fprintf(stdout, "  with filters adapted from the nearest of these above, or from 48000Hz.\n");
 	fprintf(stdout, "  16 bit integer 'aiff' files are also supported.\n");
 	fprintf(stdout, "  Wildcards (?, *) can be used in the filename, or '-' for stdin.\n");
 
@@ -450,7 +893,19 @@ static const struct option long_options[] = {
 	{"force",	0, NULL,  0 },
 	{"undo-gain",	0, NULL,  0 },
 	{"fast",	0, NULL, 's'},
+	{"estimate",	1, NULL,  0 },
+	{"monitor",	1, NULL,  0 },
+	{"interval",	1, NULL,  0 },
 	{"stdout",	0, NULL, 'o'},
+	{"threads",	1, NULL,  0 },
+	{"single",	0, NULL,  0 },
+	{"preview",	0, NULL,  0 },
+	{"preview-compare", 0, NULL, 0 },
+	{"channel-weights", 1, NULL, 0 },
+	{"true-peak",	0, NULL,  0 },
+	{"loudness",	0, NULL,  0 },
+	{"histogram",	0, NULL,  0 },
+	{"merge",	0, NULL,  0 },
 #ifdef ENABLE_RECURSIVE
 	{"recursive",   0, NULL, 'z'},
 #endif
@@ -494,6 +949,8 @@ int main(int argc, char** argv)
 	settings.clip_prev = 1;
 	settings.outbitwidth = 16;
 	settings.format = WAV_NO_FMT;
+	settings.threads = 1;
+	settings.interval = 1.;
 
 #ifdef _WIN32
 	/* Is this good enough? Or do we need to consider multi-byte codepages as 
@@ -515,6 +972,58 @@ int main(int argc, char** argv)
 				else if (!strcmp(long_options[option_index].name, "undo-gain")) {
 					settings.undo = 1;
 				}
+				else if (!strcmp(long_options[option_index].name, "threads")) {
+					if (sscanf(optarg, "%d", &settings.threads) != 1 || settings.threads < 0) {
+						fprintf(stderr, "Warning: number of threads %s not recognised, using 1\n", optarg);
+						settings.threads = 1;
+					}
+					else if (settings.threads == 0)
+						settings.threads = cpu_count();
+				}
+				else if (!strcmp(long_options[option_index].name, "estimate")) {
+					if (sscanf(optarg, "%lf", &settings.estimate) != 1 || !(settings.estimate > 0.)) {
+						fprintf(stderr, "Warning: estimate tolerance %s not recognised, analysing in full\n", optarg);
+						settings.estimate = 0.;
+					}
+				}
+				else if (!strcmp(long_options[option_index].name, "monitor")) {
+					if (sscanf(optarg, "%lf", &settings.monitor) != 1 || !(settings.monitor > 0.)) {
+						fprintf(stderr, "Warning: monitor length %s not recognised, analysing in full\n", optarg);
+						settings.monitor = 0.;
+					}
+				}
+				else if (!strcmp(long_options[option_index].name, "interval")) {
+					if (sscanf(optarg, "%lf", &settings.interval) != 1 || !(settings.interval > 0.)) {
+						fprintf(stderr, "Warning: interval %s not recognised, using 1 second\n", optarg);
+						settings.interval = 1.;
+					}
+				}
+				else if (!strcmp(long_options[option_index].name, "single")) {
+					settings.single = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "preview")) {
+					settings.preview = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "preview-compare")) {
+					settings.preview = 1;
+					settings.preview_compare = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "true-peak")) {
+					settings.true_peak = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "loudness")) {
+					settings.loudness = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "histogram")) {
+					settings.histogram = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "merge")) {
+					settings.merge = 1;
+				}
+				else if (!strcmp(long_options[option_index].name, "channel-weights")) {
+					if (!parse_weights(optarg, &settings))
+						fprintf(stderr, "Warning: channel weights %s not recognised, using equal weights\n", optarg);
+				}
 				else {
 					fprintf(stderr, "Internal error parsing command line options\n");
 					exit(1);
@@ -690,6 +1199,26 @@ int main(int argc, char** argv)
 		settings.write_chunk = 0;
 		settings.no_offset = 1;
 	}
+	/* Clipping prevention would only know the peak of the blocks read */
+	if (settings.estimate > 0. && settings.apply_gain) {
+		fprintf(stderr, "Warning: gains estimated with --estimate are not applied\n");
+		settings.apply_gain = 0;
+	}
+	/* A sidecar stands for the whole file, which these only read parts of */
+	if (settings.histogram && (settings.fast || settings.estimate > 0.)) {
+		fprintf(stderr, "Warning: --histogram needs whole files, not writing histograms with --fast or --estimate\n");
+		settings.histogram = 0;
+	}
+	/* Sidecars only give the gains, and always of an album */
+	if (settings.merge) {
+		settings.audiophile = 1;
+		settings.apply_gain = 0;
+		settings.no_offset = 1;
+		settings.undo = 0;
+		settings.histogram = 0;
+		settings.monitor = 0.;
+		settings.preview_compare = 0;
+	}
 
 	if (optind >= argc) {
 		fprintf(stderr, _("No files specified.\n"));
@@ -704,13 +1233,29 @@ int main(int argc, char** argv)
 		write_log("\n");
 	}
 
-	if (!strcmp(argv[optind], "-")) {
-		double track_peak, track_gain;
-		double dc_offset;
-		double offset;
-		if (!get_gain("-", &track_peak, &track_gain,
-		              &dc_offset, &offset, &settings))
+	if (!strcmp(argv[optind], "-") && !settings.merge) {
+		FILE_LIST        file;
+		gain_analysis_t* analyzer = CreateGainAnalysis(0);
+
+		memset(&file, 0, sizeof(file));
+		file.filename = "-";
+		if (analyzer == NULL)
+			return -1;
+		if (settings.monitor > 0.) {
+			DestroyGainAnalysis(analyzer);
+			return monitor_gain(&file, &settings) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+		SetSinglePrecisionCtx(analyzer, settings.single);
+		SetPreviewCtx(analyzer, settings.preview);
+		SetChannelWeightsCtx(analyzer, settings.num_weights ? settings.weights : NULL, settings.num_weights);
+		SetTruePeakCtx(analyzer, settings.true_peak);
+		if (SetLoudnessCtx(analyzer, settings.loudness) != GAIN_ANALYSIS_OK
+		    || !analyze_gain(&file, analyzer, &settings, 1)) {
+			DestroyGainAnalysis(analyzer);
 			return -1;
+		}
+		report_gain(&file, &settings);
+		DestroyGainAnalysis(analyzer);
 	}
 	else {
 		for (i = optind; i < argc; ++i) {
@@ -13,6 +13,8 @@
 #include <windows.h>
 #endif
 
+#include "misc.h"
+
 /** Information about a file to process */
 typedef struct file_list
 {
@@ -20,8 +22,15 @@ typedef struct file_list
     const char* filename;
     double track_gain;
     double track_peak;
-    double dc_offset[2];
-    double offset[2];
+    double dc_offset[MAX_CHANNELS];
+    double offset[MAX_CHANNELS];
+    double peak;                  /**< Sample peak, before any gain is applied */
+    double scale;                 /**< Scale factor of track_gain */
+    double samples;               /**< Number of samples per channel */
+    double error;                 /**< Confidence interval of an estimated track gain, in dB */
+    double share;                 /**< Share of the file read for an estimate, 0 if read in full */
+    double loudness;              /**< Integrated loudness in LUFS, see GetTitleLoudnessCtx() */
+    double loudness_range;        /**< Loudness range in LU */
 } FILE_LIST;
 
 
@@ -44,6 +53,18 @@ typedef struct settings
     int undo;                     /**< Read the value in the 'gain' chunk and re-scale the data */
     int set_album_gain;           /**< Don't apply the calculated album gain if set */
     int fast;                     /**< Use the fast routines for RG analysis */
+    double estimate;              /**< Estimate the track gain to within this many dB, 0 to analyze in full */
+    double monitor;               /**< Seconds of input the gains of --monitor cover, 0 if off */
+    double interval;              /**< Seconds between the gains of --monitor */
+    int single;                   /**< Analyze in single precision, see SetSinglePrecisionCtx() */
+    int preview;                  /**< Decimate hi-res input before analysis, see SetPreviewCtx() */
+    int preview_compare;          /**< List preview gains against full rate ones, see compare_preview() */
+    double weights[MAX_CHANNELS]; /**< Loudness weight of each channel, see SetChannelWeightsCtx() */
+    int num_weights;              /**< Number of weights given, 0 for equal weights */
+    int true_peak;                /**< Use the true peak for clipping prevention, see SetTruePeakCtx() */
+    int loudness;                 /**< Measure the loudness as well, see SetLoudnessCtx() */
+    int histogram;                /**< Write the histograms of each file to a sidecar, see write_histogram() */
+    int merge;                    /**< Add up histogram sidecars instead of analyzing, see merge_histograms() */
     int std_out;                  /**< Write output file to stdout */
     int radio;                    /**< Calculate Title gain  */
     int adc;                      /**< Apply Album based DC Offset correction (default is Track based)  */
@@ -57,6 +78,7 @@ typedef struct settings
     unsigned int outbitwidth;     /**< bitwidth of desired output */
     unsigned int format;          /**< format of desired output */
     int need_to_process;          /**< need to process even if peak unchanged */
+    int threads;                  /**< Number of files to process at the same time */
     char* cmd;
 } SETTINGS;
 
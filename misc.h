@@ -13,6 +13,8 @@ typedef signed   long long  Int64_t;
 typedef unsigned long long  Uint64_t;
 #endif
 
+#define MAX_CHANNELS  8		/* most channels a file may have, GAIN_MAX_CHANNELS */
+
 void file_error(const char* message, ...);
 char* last_path(const char* path);
 extern void write_log(const char *fmt, ...);
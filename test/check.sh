@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Tests for 'make check': test/check.sh ./wavegain, run from the top of the
+# tree once the test programs are built.
+#
+# Generated test signals go into test/ next to the sample files there, and
+# each file in test/ is then analyzed on one thread and split into segments
+# on several (see analyze_segments() in wavegain.c). The gains, peaks and
+# loudness printed and the histogram sidecars must come out the same.
+#
+# A file written with the gain applied must also come out the same on one
+# thread and on several. test/filters then checks the analysis filters, also
+# on the files in test/, see test/filters.c, and test/filters_block the block
+# filters that config.h leaves out.
+
+WAVEGAIN=${1:-./wavegain}
+THREADS=4
+failed=0
+
+fail()
+{
+	echo "FAIL: $*"
+	failed=1
+}
+
+# Rate, channels and length of each signal. Segments are at least 10 s long,
+# so these make two to four of them. 37800 Hz has no row in the filter
+# tables, see designFilters() in gain_analysis.c.
+for signal in 44100:2:45 48000:1:25 96000:2:22 8000:2:30 37800:2:25; do
+	set -- `echo $signal | tr : ' '`
+	test/mksignal test/signal_$1_$2.wav $1 $2 $3 $1 || fail "can't write test/signal_$1_$2.wav"
+done
+
+for file in test/*.wav; do
+	rm -f "$file.wgh" test/threads.out test/threads.wgh
+	"$WAVEGAIN" -r --loudness --true-peak --histogram --threads 1 "$file" > test/threads.out 2>&1
+	[ -f "$file.wgh" ] && mv "$file.wgh" test/threads.wgh
+	"$WAVEGAIN" -r --loudness --true-peak --histogram --threads $THREADS "$file" 2>&1 \
+		| cmp -s - test/threads.out || fail "$file: --threads $THREADS prints other results than --threads 1"
+	if [ -f test/threads.wgh ]; then
+		cmp -s "$file.wgh" test/threads.wgh || fail "$file: --threads $THREADS gives other histograms than --threads 1"
+	elif [ -f "$file.wgh" ]; then
+		fail "$file: only --threads $THREADS wrote a histogram"
+	fi
+	rm -f "$file.wgh"
+done
+rm -f test/threads.out test/threads.wgh
+
+# Applying the gain, several threads each write a range of the file (see
+# write_ranges() in wavegain.c) with its own dither sequence, which one thread
+# restarts at the same samples, so the files must come out the same byte for
+# byte. 60 seconds at 44100 Hz make two ranges and part of a third.
+for threads in 1 $THREADS; do
+	test/mksignal test/signal_apply_$threads.wav 44100 2 60 6 || fail "can't write test/signal_apply_$threads.wav"
+	"$WAVEGAIN" -y -d 3 -g 3 --threads $threads test/signal_apply_$threads.wav > /dev/null 2>&1 \
+		|| fail "can't apply the gain with --threads $threads"
+done
+cmp -s test/signal_apply_1.wav test/signal_apply_$THREADS.wav \
+	|| fail "-y -d 3 -g 3 --threads $THREADS writes another file than --threads 1"
+rm -f test/signal_apply_*.wav
+
+test/filters test/*.wav || fail "test/filters"
+test/filters_block || fail "test/filters_block"
+
+[ $failed = 0 ] && echo "All tests passed"
+exit $failed
@@ -0,0 +1,764 @@
+/*
+ * Tests of the analysis filters for 'make check'
+ *
+ * Built with gain_analysis.c included, so the filters can be run on their
+ * own, and once more as test/filters_block with ENABLE_BLOCK_FILTERS, so the
+ * AVX filters are the block ones. Each filter this processor can run (see avxLevel()) is compared with
+ * the plain C filterSamples() at every rate in the tables and at one that
+ * designFilters() works out, on noise fed in blocks of 1 to 4801 samples.
+ * The same noise, analyzed in single precision (SetSinglePrecisionCtx()),
+ * must give RMS windows and title gains within SINGLE_TOLERANCE of double
+ * precision; the largest differences are printed. Last, the histograms of
+ * that noise and of the Wave files given on the command line must come out
+ * the same from the Yule filter's second-order sections (ABYuleSections) as
+ * from its direct form, up to a few windows right on a step moving by one,
+ * and skipping the windows of digital silence between quiet passages must
+ * leave the histograms as they are without, and the filters less than
+ * SILENCE_FLOOR from where filtering the silence leaves them.
+ *
+ * This program is distributed under the GNU General Public License, version
+ * 2.1. A copy of this license is included with this source.
+ */
+#include "gain_analysis.c"
+
+/* Rate without a row in the filter tables, tested after those in freqs */
+#define DESIGN_FREQ       37800
+#define TEST_RATES        13
+#define TEST_SECONDS      2
+/* Length of the noise analyzed in full, rather than just filtered */
+#define ANALYSIS_SECONDS  20
+/* Largest difference of the filter outputs from those of filterSamples(), as
+ * a share of the largest input sample of the last LEVEL_SAMPLES. The AVX
+ * filters run the direct form and add the terms up in another order, which
+ * only comes to about 1e-11, or 2e-8 with the block filters; a coefficient
+ * off by 1e-4 gives 1e-6 and more. */
+#define KERNEL_TOLERANCE  1e-6
+#define LEVEL_SAMPLES     1000
+/* Largest difference [dB] of the loudness of an RMS window and of the title
+ * gain in single precision, one step of the histograms */
+#define SINGLE_TOLERANCE  0.01
+/* Share of the RMS windows that may land in the next step with the Yule
+ * filter's sections than in direct form. The two differ by 1e-11 of the
+ * signal at most, so only windows right on a step can move. */
+#define SECTIONS_MOVED    0.001
+/* Length of the quiet passages and of the digital silence after each [s], and
+ * the number of both analyzed */
+#define SILENCE_SECONDS   1
+#define SILENCE_ANALYZED  10
+
+#ifdef USE_AVX
+
+static unsigned int seed;
+
+/* Uniform in [-1, 1) */
+static double noise(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (double)(seed >> 8) / (1 << 23) - 1.;
+}
+
+/* Fill left and right (each with MAX_ORDER samples of history before it) with
+ * n samples of noise at a level changing every LEVEL_SAMPLES samples, the
+ * right channel partly the left one. */
+static void make_signal(Float_t *left, Float_t *right, long n, unsigned int start)
+{
+	double level = 0.;
+	long   i;
+
+	seed = start;
+	for (i = -MAX_ORDER; i < n; i++) {
+		if (i < 0) {
+			left[i] = right[i] = 0.;
+			continue;
+		}
+		if (i % LEVEL_SAMPLES == 0)
+			level = 32767. * pow(10., -1.5 * (noise() + 1.));
+		left[i] = level * noise();
+		right[i] = 0.5 * left[i] + 0.5 * level * noise();
+	}
+}
+
+static long test_rate(int i)
+{
+	return i < 12 ? freqs[i] : DESIGN_FREQ;
+}
+
+/* Allocate n samples with MAX_ORDER of history before them for each channel
+ * and fill them with make_signal(). Free with free(*left - MAX_ORDER). */
+static void alloc_signal(Float_t **left, Float_t **right, long n, unsigned int start)
+{
+	*left = malloc((n + MAX_ORDER) * sizeof(Float_t));
+	*right = malloc((n + MAX_ORDER) * sizeof(Float_t));
+	if (*left == NULL || *right == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	*left += MAX_ORDER;
+	*right += MAX_ORDER;
+	make_signal(*left, *right, n, start);
+}
+
+/* Length of the next block of a signal fed in blocks of 1 to 4801 samples */
+static long next_block(unsigned int *blocks)
+{
+	*blocks = *blocks * 1103515245 + 12345;
+	return 1 + (long)((*blocks >> 8) % 4801);
+}
+
+#ifndef USE_BLOCK_FILTERS
+
+/* feedBackStereo() after the Yule filter's b-terms summed in plain C */
+static void feedBackPlain(gain_analysis_t *ctx, const Float_t *curleft, const Float_t *curright, long cursamples)
+{
+	Float_t lstep[FILTER_TILE],
+	        rstep[FILTER_TILE];
+	long    n, m, i;
+	int     k;
+
+	for (n = 0; n < cursamples; n += m) {
+		m = cursamples - n < FILTER_TILE ? cursamples - n : FILTER_TILE;
+		for (i = 0; i < m; i++) {
+			lstep[i] = rstep[i] = 1e-10;
+			for (k = 0; k <= YULE_ORDER; k++) {
+				lstep[i] += curleft[n + i - k] * ctx->yule[2*k];
+				rstep[i] += curright[n + i - k] * ctx->yule[2*k];
+			}
+		}
+		feedBackStereo(ctx, lstep, rstep, m);
+	}
+}
+
+#endif
+
+/* Run filter over the signal at rate in blocks of random length, and
+ * filterSamples() next to it. Returns the largest difference of the outputs
+ * (see KERNEL_TOLERANCE), or a negative number if the sums of squares are too
+ * far apart. */
+static double compare_kernel(filter_func filter, long rate, const Float_t *left, const Float_t *right, long n)
+{
+	gain_analysis_t *ref = CreateGainAnalysis(rate),
+	                *ctx = CreateGainAnalysis(rate);
+	double          worst = 0.,
+	                peak,
+	                diff;
+	long            pos, m, i;
+	unsigned int    blocks = (unsigned int)rate;
+
+	if (ref == NULL || ctx == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (pos = 0; pos < n; pos += m) {
+		m = next_block(&blocks);
+		if (m > n - pos)
+			m = n - pos;
+		filterSamples(ref, left + pos, right + pos, m);
+		filter(ctx, left + pos, right + pos, m);
+
+		diff = fabs(ctx->lout[MAX_ORDER-1] - ref->lout[MAX_ORDER-1]);
+		if (fabs(ctx->rout[MAX_ORDER-1] - ref->rout[MAX_ORDER-1]) > diff)
+			diff = fabs(ctx->rout[MAX_ORDER-1] - ref->rout[MAX_ORDER-1]);
+		for (peak = 0., i = pos + m > LEVEL_SAMPLES ? pos + m - LEVEL_SAMPLES : 0; i < pos + m; i++) {
+			if (fabs(left[i]) > peak)
+				peak = fabs(left[i]);
+			if (fabs(right[i]) > peak)
+				peak = fabs(right[i]);
+		}
+		if (peak > 0. && diff / peak > worst)
+			worst = diff / peak;
+	}
+	if (fabs(ctx->lsum - ref->lsum) > KERNEL_TOLERANCE * ref->lsum
+	    || fabs(ctx->rsum - ref->rsum) > KERNEL_TOLERANCE * ref->rsum)
+		worst = -1.;
+	DestroyGainAnalysis(ref);
+	DestroyGainAnalysis(ctx);
+	return worst;
+}
+
+#endif
+
+/* Compare each AVX filter this processor runs with filterSamples().
+ * Returns the number of failures. */
+static int test_kernels(void)
+{
+#ifdef USE_AVX
+	static const struct {
+		const char  *name;
+		filter_func filter;
+		int         level;
+	} kernels[] = {
+#ifdef USE_BLOCK_FILTERS
+		{"AVX2 block filters", filterSamplesAVX2, 1},
+		{"AVX-512 block filters", filterSamplesAVX512, 2},
+#else
+		{"filterSamplesAVX2", filterSamplesAVX2, 1},
+		{"filterSamplesAVX512", filterSamplesAVX512, 2},
+#endif
+#ifndef USE_BLOCK_FILTERS
+		{"feedBackStereo", feedBackPlain, 1},
+#endif
+	};
+	long    rate;
+	Float_t *left,
+	        *right;
+	double  worst,
+	        largest;
+	int     failed = 0,
+	        i, k;
+
+	for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++) {
+		if (avxLevel() < kernels[k].level) {
+			printf("%-20s skipped, not supported by this processor\n", kernels[k].name);
+			continue;
+		}
+		largest = 0.;
+		for (i = 0; i < TEST_RATES; i++) {
+			rate = test_rate(i);
+			alloc_signal(&left, &right, TEST_SECONDS * rate, (unsigned int)rate);
+			worst = compare_kernel(kernels[k].filter, rate, left, right, TEST_SECONDS * rate);
+			if (worst < 0. || worst > KERNEL_TOLERANCE) {
+				if (worst < 0.)
+					printf("FAIL: %s at %ld Hz: sums of squares differ from filterSamples()\n",
+					       kernels[k].name, rate);
+				else
+					printf("FAIL: %s at %ld Hz: differs from filterSamples() by %.2g\n",
+					       kernels[k].name, rate, worst);
+				failed++;
+			}
+			if (worst > largest)
+				largest = worst;
+			free(left - MAX_ORDER);
+			free(right - MAX_ORDER);
+		}
+		printf("%-20s largest difference from filterSamples() %.2g\n", kernels[k].name, largest);
+	}
+	return failed;
+#else
+	printf("Filter kernels skipped, built without AVX\n");
+	return 0;
+#endif
+}
+
+#ifdef USE_AVX
+
+/* Feed n samples of a signal to ctx in blocks of random length */
+static void analyze_signal(gain_analysis_t *ctx, const Float_t *left, const Float_t *right, long n, int channels)
+{
+	unsigned int blocks = (unsigned int)n;
+	long         pos, m;
+
+	for (pos = 0; pos < n; pos += m) {
+		m = next_block(&blocks);
+		if (m > n - pos)
+			m = n - pos;
+		if (AnalyzeSamplesCtx(ctx, left + pos, right + pos, m, channels) != GAIN_ANALYSIS_OK) {
+			fprintf(stderr, "Error analyzing samples\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* Run filter, one of the single precision filters, and filterSamples() over
+ * the RMS windows of a signal at rate, and return the largest difference of
+ * the loudness of a window, in dB */
+static double compare_windows(filter_func filter, long rate, const Float_t *left, const Float_t *right, long n)
+{
+	gain_analysis_t *ref = CreateGainAnalysis(rate),
+	                *ctx = CreateGainAnalysis(rate);
+	double          worst = 0.,
+	                diff;
+	long            pos, m;
+
+	if (ref == NULL || ctx == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (pos = 0; pos < n; pos += m) {
+		m = n - pos < ctx->sampleWindow ? n - pos : ctx->sampleWindow;
+		ctx->lsum = ctx->rsum = ref->lsum = ref->rsum = 0.;
+		filterSamples(ref, left + pos, right + pos, m);
+		filter(ctx, left + pos, right + pos, m);
+		diff = fabs(10. * log10((ctx->lsum + ctx->rsum) / (ref->lsum + ref->rsum)));
+		if (diff > worst)
+			worst = diff;
+	}
+	DestroyGainAnalysis(ref);
+	DestroyGainAnalysis(ctx);
+	return worst;
+}
+
+#endif
+
+/* Measure how far single precision is from double precision: the loudness of
+ * each RMS window with each single precision filter this processor can run,
+ * and the title gain of the whole analysis. Returns the number of failures. */
+static int test_single(void)
+{
+#ifdef USE_AVX
+	static const struct {
+		filter_func filter;
+		int         level;
+	} kernels[] = {
+		{filterSamplesFloatAVX2, 1},
+		{filterSamplesFloatAVX512, 2},
+	};
+	gain_analysis_t *ref,
+	                *ctx;
+	Float_t         *left,
+	                *right;
+	long            rate,
+	                n;
+	double          window_worst = 0.,
+	                worst = 0.,
+	                diff;
+	int             failed = 0,
+	                i, k;
+
+	if (avxLevel() == 0) {
+		printf("Single precision skipped, not supported by this processor\n");
+		return 0;
+	}
+	for (i = 0; i < TEST_RATES; i++) {
+		rate = test_rate(i);
+		n = ANALYSIS_SECONDS * rate;
+		alloc_signal(&left, &right, n, (unsigned int)rate);
+		for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])) && avxLevel() >= kernels[k].level; k++) {
+			diff = compare_windows(kernels[k].filter, rate, left, right, n);
+			if (diff > SINGLE_TOLERANCE) {
+				printf("FAIL: single precision at %ld Hz: a window %.2g dB off\n", rate, diff);
+				failed++;
+			}
+			if (diff > window_worst)
+				window_worst = diff;
+		}
+
+		if ((ref = CreateGainAnalysis(rate)) == NULL || (ctx = CreateGainAnalysis(rate)) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		SetSinglePrecisionCtx(ctx, 1);
+		analyze_signal(ref, left, right, n, 2);
+		analyze_signal(ctx, left, right, n, 2);
+		diff = fabs(GetTitleGainCtx(ctx) - GetTitleGainCtx(ref));
+		if (diff > SINGLE_TOLERANCE + 1e-6) {
+			printf("FAIL: single precision at %ld Hz: title gain %.2f dB off\n", rate, diff);
+			failed++;
+		}
+		if (diff > worst)
+			worst = diff;
+		DestroyGainAnalysis(ref);
+		DestroyGainAnalysis(ctx);
+		free(left - MAX_ORDER);
+		free(right - MAX_ORDER);
+	}
+	printf("Single precision     largest title gain difference %.2f dB, window loudness %.2g dB\n",
+	       worst, window_worst);
+	return failed;
+#else
+	printf("Single precision skipped, built without AVX\n");
+	return 0;
+#endif
+}
+
+#ifdef USE_AVX
+
+/* The Yule and Butterworth filters in direct form, as the plain C filters
+ * ran them before ABYuleSections: the Yule filter's history is in lstep and
+ * rstep, the Butterworth filter's in lout and rout */
+static void filterDirect(gain_analysis_t *ctx, const Float_t *curleft, const Float_t *curright, long cursamples)
+{
+	Float_t       step[MAX_ORDER + FILTER_TILE],
+	              out[MAX_ORDER + FILTER_TILE],
+	              *hist_step,
+	              *hist_out;
+	const Float_t *input,
+	              *ay = ctx->yule,
+	              *ab = ctx->butter;
+	double        *sum;
+	long          n, m, i;
+	int           c, k;
+
+	for (c = 0; c < 2; c++) {
+		input = c ? curright : curleft;
+		hist_step = c ? ctx->rstep : ctx->lstep;
+		hist_out = c ? ctx->rout : ctx->lout;
+		sum = c ? &ctx->rsum : &ctx->lsum;
+		memcpy(step, hist_step, MAX_ORDER * sizeof(Float_t));
+		memcpy(out, hist_out, MAX_ORDER * sizeof(Float_t));
+		for (n = 0; n < cursamples; n += m) {
+			m = cursamples - n < FILTER_TILE ? cursamples - n : FILTER_TILE;
+			for (i = 0; i < m; i++) {
+				Float_t *y = step + MAX_ORDER + i,
+				        *z = out + MAX_ORDER + i;
+
+				/* 1e-10 is a hack to avoid slowdown because of denormals */
+				*y = 1e-10 + input[n + i] * ay[0];
+				for (k = 1; k <= YULE_ORDER; k++)
+					*y += input[n + i - k] * ay[2*k] - y[-k] * ay[2*k - 1];
+				*z = y[0] * ab[0] - z[-1] * ab[1] + y[-1] * ab[2] - z[-2] * ab[3] + y[-2] * ab[4];
+				*sum += fsqr(*z);
+			}
+			memmove(step, step + m, MAX_ORDER * sizeof(Float_t));
+			memmove(out, out + m, MAX_ORDER * sizeof(Float_t));
+		}
+		memcpy(hist_step, step, MAX_ORDER * sizeof(Float_t));
+		memcpy(hist_out, out, MAX_ORDER * sizeof(Float_t));
+	}
+}
+
+/* The gains of the RMS windows of the current title of ctx, loudest first, in
+ * an array that has to be freed */
+static Float_t *window_gains(const gain_analysis_t *ctx, size_t *n)
+{
+	Float_t *gains;
+
+	*n = GetTitleWindowGainsCtx(ctx, NULL, 0);
+	if ((gains = malloc((*n + 1) * sizeof(Float_t))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	GetTitleWindowGainsCtx(ctx, gains, *n);
+	return gains;
+}
+
+/* Read a 16 bit PCM Wave file, as test/mksignal writes them. Returns the
+ * number of samples per channel, with the samples in *left and *right (the
+ * same for a mono file, to be freed with free(*left - MAX_ORDER)), or 0 if
+ * the file can't be read. */
+static long read_wav(const char *filename, long *rate, int *channels, Float_t **left, Float_t **right)
+{
+	FILE          *in = fopen(filename, "rb");
+	unsigned char header[12],
+	              fmt[16];
+	unsigned long size = 0;
+	long          n = 0,
+	              i;
+	int           c, bits = 0;
+
+	*channels = 0;
+	if (in == NULL || fread(header, 1, 12, in) != 12 || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4))
+		goto exit;
+	while (fread(header, 1, 8, in) == 8) {
+		size = header[4] | header[5] << 8 | (unsigned long)header[6] << 16 | (unsigned long)header[7] << 24;
+		if (!memcmp(header, "fmt ", 4) && size >= 16 && fread(fmt, 1, 16, in) == 16) {
+			if (fmt[0] != 1 || fmt[1] != 0)
+				goto exit;
+			*channels = fmt[2] | fmt[3] << 8;
+			*rate = fmt[4] | fmt[5] << 8 | (long)fmt[6] << 16 | (long)fmt[7] << 24;
+			bits = fmt[14] | fmt[15] << 8;
+			size -= 16;
+		}
+		else if (!memcmp(header, "data", 4))
+			break;
+		if (fseek(in, (long)(size + (size & 1)), SEEK_CUR) != 0)
+			goto exit;
+	}
+	if (feof(in) || bits != 16 || *channels < 1 || *channels > 2)
+		goto exit;
+
+	n = (long)(size / (2 * *channels));
+	alloc_signal(left, right, n, 0);
+	for (i = 0; i < n; i++) {
+		for (c = 0; c < *channels; c++) {
+			if (fread(header, 1, 2, in) != 2) {
+				free(*left - MAX_ORDER);
+				free(*right - MAX_ORDER);
+				n = 0;
+				goto exit;
+			}
+			(c ? *right : *left)[i] = (Int16_t)(header[0] | header[1] << 8);
+		}
+	}
+	if (*channels == 1)
+		memcpy(*right, *left, n * sizeof(Float_t));
+
+exit:
+	if (in)
+		fclose(in);
+	return n;
+}
+
+/* Analyze a signal with the Yule filter's sections and in direct form, and
+ * check the histograms (see SECTIONS_MOVED). Returns 1 if they are too far
+ * apart, else 0, and adds the windows in another step to *moved and those
+ * analyzed to *total. */
+static int compare_sections(const char *name, long rate, const Float_t *left, const Float_t *right, long n,
+                            int channels, long *moved, long *total)
+{
+	gain_analysis_t *ref = CreateGainAnalysis(rate),
+	                *ctx = CreateGainAnalysis(rate);
+	Float_t         *ref_gains,
+	                *gains;
+	size_t          ref_windows,
+	                windows,
+	                j;
+	long            windows_moved = 0;
+	int             failed = 0;
+
+	if (ref == NULL || ctx == NULL) {
+		printf("%s: can't analyze %ld Hz\n", name, rate);
+		exit(EXIT_FAILURE);
+	}
+	ref->filterSamples = filterDirect;
+	ctx->filterSamples = filterSamples;
+	analyze_signal(ref, left, right, n, channels);
+	analyze_signal(ctx, left, right, n, channels);
+
+	ref_gains = window_gains(ref, &ref_windows);
+	gains = window_gains(ctx, &windows);
+	if (windows != ref_windows) {
+		printf("FAIL: sections on %s: %lu windows instead of %lu\n", name,
+		       (unsigned long)windows, (unsigned long)ref_windows);
+		failed = 1;
+	}
+	for (j = 0; j < windows && j < ref_windows; j++) {
+		if (gains[j] == ref_gains[j])
+			continue;
+		windows_moved++;
+		if (fabs(gains[j] - ref_gains[j]) > 1.5 / STEPS_per_dB) {
+			printf("FAIL: sections on %s: window gain %.2f dB instead of %.2f dB\n", name,
+			       gains[j], ref_gains[j]);
+			failed = 1;
+			break;
+		}
+	}
+	if (windows_moved > SECTIONS_MOVED * ref_windows) {
+		printf("FAIL: sections on %s: %ld of %lu windows in another step\n", name,
+		       windows_moved, (unsigned long)ref_windows);
+		failed = 1;
+	}
+	*moved += windows_moved;
+	*total += (long)ref_windows;
+	if (GetTitleGainCtx(ctx) != GetTitleGainCtx(ref)) {
+		printf("FAIL: sections on %s: title gain differs from the direct form\n", name);
+		failed = 1;
+	}
+	free(ref_gains);
+	free(gains);
+	DestroyGainAnalysis(ref);
+	DestroyGainAnalysis(ctx);
+	return failed;
+}
+
+#endif
+
+/* Compare the histograms of the Yule filter's sections with those of the
+ * direct form on noise at every rate and on the files given. Returns the
+ * number of failures. */
+static int test_sections(char **files, int count)
+{
+#ifdef USE_AVX
+	Float_t *left,
+	        *right;
+	char    name[32];
+	long    rate,
+	        n,
+	        moved = 0,
+	        total = 0;
+	int     failed = 0,
+	        channels,
+	        i;
+
+	for (i = 0; i < TEST_RATES; i++) {
+		rate = test_rate(i);
+		n = ANALYSIS_SECONDS * rate;
+		alloc_signal(&left, &right, n, (unsigned int)rate);
+		sprintf(name, "noise at %ld Hz", rate);
+		failed += compare_sections(name, rate, left, right, n, 2, &moved, &total);
+		free(left - MAX_ORDER);
+		free(right - MAX_ORDER);
+	}
+	for (i = 0; i < count; i++) {
+		if ((n = read_wav(files[i], &rate, &channels, &left, &right)) == 0) {
+			printf("%-20s skipped, not a 16 bit PCM Wave file\n", files[i]);
+			continue;
+		}
+		failed += compare_sections(files[i], rate, left, right, n, channels, &moved, &total);
+		free(left - MAX_ORDER);
+		free(right - MAX_ORDER);
+	}
+	printf("Yule sections        %ld of %ld windows in another step than with the direct form\n",
+	       moved, total);
+	return failed;
+#else
+	(void)files;
+	(void)count;
+	printf("Yule sections skipped, built without AVX (no direct form)\n");
+	return 0;
+#endif
+}
+
+#ifdef USE_AVX
+
+static filter_func counted;
+static long        filtered;
+
+/* The filters of ctx, counting the samples that go through them */
+static void count_filter(gain_analysis_t *ctx, const Float_t *curleft, const Float_t *curright, long cursamples)
+{
+	filtered += cursamples;
+	counted(ctx, curleft, curright, cursamples);
+}
+
+/* Fill left and right (each with MAX_ORDER samples of history before it) with
+ * n samples of quiet passages of noise, each SILENCE_SECONDS long at a level
+ * of 0.1 to 30, with SILENCE_SECONDS of digital silence after each. They are
+ * a third of a second off the seconds, so off the RMS windows too. */
+static void make_quiet_signal(Float_t *left, Float_t *right, long n, long rate)
+{
+	double level = 0.;
+	long   i;
+
+	seed = (unsigned int)rate;
+	for (i = -MAX_ORDER; i < n; i++) {
+		if (i < 0 || (i + rate / 3) / (SILENCE_SECONDS * rate) % 2) {
+			left[i] = right[i] = 0.;
+			continue;
+		}
+		if ((i + rate / 3) % (SILENCE_SECONDS * rate) == 0)
+			level = 30. * pow(10., -1.25 * (noise() + 1.));
+		left[i] = level * noise();
+		right[i] = 0.5 * left[i] + 0.5 * level * noise();
+	}
+}
+
+/* Largest difference of the filter states of ctx and ref */
+static double state_difference(const gain_analysis_t *ctx, const gain_analysis_t *ref)
+{
+	double diff = 0.;
+	int    i;
+
+	for (i = 0; i < MAX_ORDER; i++) {
+		diff = fmax(diff, fabs(ctx->lstep[i] - ref->lstep[i]));
+		diff = fmax(diff, fabs(ctx->rstep[i] - ref->rstep[i]));
+		diff = fmax(diff, fabs(ctx->lout[i] - ref->lout[i]));
+		diff = fmax(diff, fabs(ctx->rout[i] - ref->rout[i]));
+	}
+	for (i = 0; i < YULE_SECTIONS * 4; i++)
+		diff = fmax(diff, fabs(ctx->yuleState[i] - ref->yuleState[i]));
+	for (i = 0; i < 32; i++)
+		diff = fmax(diff, fabs(ctx->floatState[i / 16][i % 16] - ref->floatState[i / 16][i % 16]));
+	return diff;
+}
+
+/* Analyze the quiet signal at rate in blocks of SILENCE_SECONDS, so that the
+ * windows of digital silence can be skipped, and in blocks one sample shorter
+ * than a window, so that none is. Returns 1 if the histograms differ or the
+ * filter states after a block are more than SILENCE_FLOOR apart, else 0; adds
+ * the windows skipped to *skipped and those analyzed to *total, and keeps the
+ * largest difference of the states in *worst. */
+static int compare_silence(long rate, int single, long *skipped, long *total, double *worst)
+{
+	gain_analysis_t *ref = CreateGainAnalysis(rate),
+	                *ctx = CreateGainAnalysis(rate);
+	Float_t         *left,
+	                *right,
+	                *ref_gains,
+	                *gains;
+	size_t          ref_windows,
+	                windows;
+	long            n = SILENCE_ANALYZED * SILENCE_SECONDS * rate,
+	                start, pos, m;
+	double          diff;
+	int             failed = 0;
+
+	left = malloc((n + MAX_ORDER) * sizeof(Float_t));
+	right = malloc((n + MAX_ORDER) * sizeof(Float_t));
+	if (ref == NULL || ctx == NULL || left == NULL || right == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	left += MAX_ORDER;
+	right += MAX_ORDER;
+	make_quiet_signal(left, right, n, rate);
+	SetSinglePrecisionCtx(ref, single);
+	SetSinglePrecisionCtx(ctx, single);
+	counted = ctx->filterSamples;
+	ctx->filterSamples = count_filter;
+	filtered = 0;
+
+	for (start = 0; start < n; start += SILENCE_SECONDS * rate) {
+		for (pos = start; pos < start + SILENCE_SECONDS * rate; pos += m) {
+			m = start + SILENCE_SECONDS * rate - pos;
+			if (m > ref->sampleWindow - 1)
+				m = ref->sampleWindow - 1;
+			if (AnalyzeSamplesCtx(ref, left + pos, right + pos, m, 2) != GAIN_ANALYSIS_OK) {
+				fprintf(stderr, "Error analyzing samples\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (AnalyzeSamplesCtx(ctx, left + start, right + start, SILENCE_SECONDS * rate, 2) != GAIN_ANALYSIS_OK) {
+			fprintf(stderr, "Error analyzing samples\n");
+			exit(EXIT_FAILURE);
+		}
+		if (start / (SILENCE_SECONDS * rate) % 2)
+			continue;
+		diff = state_difference(ctx, ref);
+		if (diff > SILENCE_FLOOR && !failed) {
+			printf("FAIL: digital silence at %ld Hz%s: filters %.2g off\n", rate,
+			       single ? " in single precision" : "", diff);
+			failed = 1;
+		}
+		if (diff > *worst)
+			*worst = diff;
+	}
+
+	ref_gains = window_gains(ref, &ref_windows);
+	gains = window_gains(ctx, &windows);
+	if (windows != ref_windows || memcmp(gains, ref_gains, windows * sizeof(Float_t))
+	    || GetTitleGainCtx(ctx) != GetTitleGainCtx(ref)) {
+		printf("FAIL: digital silence at %ld Hz%s: other histogram when its windows are skipped\n", rate,
+		       single ? " in single precision" : "");
+		failed = 1;
+	}
+	*skipped += (n - filtered) / ctx->sampleWindow;
+	*total += (long)ref_windows;
+	free(ref_gains);
+	free(gains);
+	free(left - MAX_ORDER);
+	free(right - MAX_ORDER);
+	DestroyGainAnalysis(ref);
+	DestroyGainAnalysis(ctx);
+	return failed;
+}
+
+#endif
+
+/* Compare the histograms of quiet passages with digital silence between them
+ * with and without skipping the silent windows (see filtersSettled()), at
+ * every rate and in both precisions. Returns the number of failures. */
+static int test_silence(void)
+{
+#ifdef USE_AVX
+	long   skipped = 0,
+	       total = 0;
+	double worst = 0.;
+	int    failed = 0,
+	       i, single;
+
+	for (single = 0; single < (avxLevel() > 0 ? 2 : 1); single++)
+		for (i = 0; i < TEST_RATES; i++)
+			failed += compare_silence(test_rate(i), single, &skipped, &total, &worst);
+	if (skipped == 0) {
+		printf("FAIL: digital silence: no window skipped\n");
+		failed++;
+	}
+	printf("Digital silence      %ld of %ld windows skipped, filters %.2g off\n",
+	       skipped, total, worst);
+	return failed;
+#else
+	printf("Digital silence skipped, built without AVX\n");
+	return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	int failed = 0;
+
+	failed += test_kernels();
+	failed += test_single();
+	failed += test_sections(argv + 1, argc - 1);
+	failed += test_silence();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/*
+ * Write a test signal for 'make check' as a 16 bit PCM Wave file
+ *
+ * The signal is noise through a one-pole lowpass, with a level that changes
+ * every half second over 50 dB, and half a second of digital silence now
+ * and then, so the RMS windows spread over many histogram steps. The right
+ * channel is partly the left one. The same arguments always give the same
+ * file.
+ *
+ * This program is distributed under the GNU General Public License, version
+ * 2.1. A copy of this license is included with this source.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+static unsigned int seed;
+
+/* Uniform in [-1, 1) */
+static double noise(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (double)(seed >> 8) / (1 << 23) - 1.;
+}
+
+static void put_le(unsigned long value, int bytes, FILE *out)
+{
+	while (bytes--) {
+		fputc((int)(value & 0xFF), out);
+		value >>= 8;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	FILE          *out;
+	unsigned long rate, samples, n;
+	int           channels, c;
+	double        level = 0.,
+	              smooth = 0.5,
+	              state[2] = {0., 0.};
+
+	if (argc != 6) {
+		fprintf(stderr, "Usage: %s file rate channels seconds seed\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	rate = strtoul(argv[2], NULL, 10);
+	channels = atoi(argv[3]);
+	samples = (unsigned long)(atof(argv[4]) * rate);
+	seed = (unsigned int)strtoul(argv[5], NULL, 10);
+	if (rate == 0 || channels < 1 || channels > 2 || (out = fopen(argv[1], "wb")) == NULL) {
+		fprintf(stderr, "%s: can't write %s\n", argv[0], argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fputs("RIFF", out);
+	put_le(36 + samples * channels * 2, 4, out);
+	fputs("WAVEfmt ", out);
+	put_le(16, 4, out);
+	put_le(1, 2, out);
+	put_le(channels, 2, out);
+	put_le(rate, 4, out);
+	put_le(rate * channels * 2, 4, out);
+	put_le(channels * 2, 2, out);
+	put_le(16, 2, out);
+	fputs("data", out);
+	put_le(samples * channels * 2, 4, out);
+
+	for (n = 0; n < samples; n++) {
+		if (n % (rate / 2) == 0) {
+			level = (n / (rate / 2)) % 23 == 7 ? 0. : 0.9 * pow(10., -1.25 * (noise() + 1.));
+			smooth = 0.1 + 0.4 * (noise() + 1.);
+		}
+		state[0] += smooth * (noise() - state[0]);
+		state[1] += smooth * (0.6 * state[0] + 0.4 * noise() - state[1]);
+		for (c = 0; c < channels; c++) {
+			long sample = (long)floor(32767. * level * state[c] + 0.5);
+
+			put_le((unsigned long)sample & 0xFFFF, 2, out);
+		}
+	}
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "%s: can't write %s\n", argv[0], argv[1]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+/*
+ * Minimal worker pool used to process several files at once
+ *
+ * This program is distributed under the GNU General Public License, version
+ * 2.1. A copy of this license is included with this source.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+#include "threads.h"
+
+#ifdef ENABLE_THREADS
+# ifdef _WIN32
+#  include <windows.h>
+#  include <process.h>
+typedef HANDLE             thread_t;
+typedef CRITICAL_SECTION   mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#  define mutex_init(m)    InitializeCriticalSection(m)
+#  define mutex_destroy(m) DeleteCriticalSection(m)
+#  define mutex_lock(m)    EnterCriticalSection(m)
+#  define mutex_unlock(m)  LeaveCriticalSection(m)
+#  define cond_init(c)     InitializeConditionVariable(c)
+#  define cond_destroy(c)
+#  define cond_wait(c, m)  SleepConditionVariableCS(c, m, INFINITE)
+#  define cond_signal(c)   WakeAllConditionVariable(c)
+# else
+#  include <pthread.h>
+#  include <unistd.h>
+typedef pthread_t          thread_t;
+typedef pthread_mutex_t    mutex_t;
+typedef pthread_cond_t     cond_t;
+#  define mutex_init(m)    pthread_mutex_init(m, NULL)
+#  define mutex_destroy(m) pthread_mutex_destroy(m)
+#  define mutex_lock(m)    pthread_mutex_lock(m)
+#  define mutex_unlock(m)  pthread_mutex_unlock(m)
+#  define cond_init(c)     pthread_cond_init(c, NULL)
+#  define cond_destroy(c)  pthread_cond_destroy(c)
+#  define cond_wait(c, m)  pthread_cond_wait(c, m)
+#  define cond_signal(c)   pthread_cond_broadcast(c)
+# endif
+
+/** Jobs shared by all workers of one run_jobs() call */
+typedef struct job_queue
+{
+	char          *jobs;
+	int           njobs;
+	size_t        job_size;
+	job_func      run;
+	int           next_job;       /**< Next job to be handed out */
+	char          *finished;      /**< finished[i] is set once job i is done */
+	mutex_t       lock;
+	cond_t        job_finished;
+} job_queue;
+
+typedef struct worker
+{
+	job_queue     *queue;
+	int           index;
+	thread_t      thread;
+} worker;
+
+/** Protects state shared by all jobs, see lock_shared() */
+# ifdef _WIN32
+static SRWLOCK         shared_lock = SRWLOCK_INIT;
+# else
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+# endif
+
+
+#ifdef _WIN32
+static unsigned __stdcall worker_main(void *arg)
+#else
+static void *worker_main(void *arg)
+#endif
+{
+	worker    *self = (worker *) arg;
+	job_queue *queue = self->queue;
+	int       job;
+
+	for (;;) {
+		mutex_lock(&queue->lock);
+		job = queue->next_job < queue->njobs ? queue->next_job++ : -1;
+		mutex_unlock(&queue->lock);
+
+		if (job < 0)
+			break;
+
+		queue->run(queue->jobs + job * queue->job_size, self->index);
+
+		mutex_lock(&queue->lock);
+		queue->finished[job] = 1;
+		cond_signal(&queue->job_finished);
+		mutex_unlock(&queue->lock);
+	}
+
+	return 0;
+}
+
+
+static int start_worker(worker *w)
+{
+#ifdef _WIN32
+	w->thread = (HANDLE) _beginthreadex(NULL, 0, worker_main, w, 0, NULL);
+	return w->thread != 0;
+#else
+	return pthread_create(&w->thread, NULL, worker_main, w) == 0;
+#endif
+}
+
+
+static void join_worker(worker *w)
+{
+#ifdef _WIN32
+	WaitForSingleObject(w->thread, INFINITE);
+	CloseHandle(w->thread);
+#else
+	pthread_join(w->thread, NULL);
+#endif
+}
+#endif /* ENABLE_THREADS */
+
+
+/**
+ * \brief Get the number of processors available.
+ *
+ * \return  number of online processors, or 1 if it can't be determined.
+ */
+int cpu_count(void)
+{
+#if defined(ENABLE_THREADS) && defined(_WIN32)
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+#elif defined(ENABLE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int) n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+/**
+ * \brief Take the lock on state shared between jobs.
+ *
+ * Jobs must hold this lock while updating counters common to all jobs and
+ * while printing progress or log messages, so lines from several workers
+ * don't get mixed up. The lock is not recursive.
+ */
+void lock_shared(void)
+{
+#if defined(ENABLE_THREADS) && defined(_WIN32)
+	AcquireSRWLockExclusive(&shared_lock);
+#elif defined(ENABLE_THREADS)
+	pthread_mutex_lock(&shared_lock);
+#endif
+}
+
+
+/**
+ * \brief Release the lock taken by lock_shared().
+ */
+void unlock_shared(void)
+{
+#if defined(ENABLE_THREADS) && defined(_WIN32)
+	ReleaseSRWLockExclusive(&shared_lock);
+#elif defined(ENABLE_THREADS)
+	pthread_mutex_unlock(&shared_lock);
+#endif
+}
+
+
+/**
+ * \brief Run a list of jobs on a pool of worker threads.
+ *
+ * Run every job in jobs on up to threads worker threads. Jobs are handed out
+ * in order, but may finish in any order. done (if not NULL) is called on the
+ * calling thread for each job, strictly in job order, as soon as that job and
+ * all jobs before it have finished; this is where results should be printed.
+ * If threads is 1 or less, or no thread can be started, all jobs are run on
+ * the calling thread, as worker 0.
+ *
+ * \param threads   maximum number of worker threads.
+ * \param jobs      array of njobs jobs, job_size bytes each.
+ * \param njobs     number of jobs.
+ * \param job_size  size of one job.
+ * \param run       function to run a job.
+ * \param done      function to call for each finished job, or NULL.
+ * \return  number of worker threads used, 0 if the jobs were run serially.
+ */
+int run_jobs(int threads, void *jobs, int njobs, size_t job_size,
+             job_func run, job_done_func done)
+{
+	int       i;
+#ifdef ENABLE_THREADS
+	job_queue queue;
+	worker    *workers;
+	int       started = 0;
+
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if (threads > njobs)
+		threads = njobs;
+
+	if (threads > 1) {
+		queue.jobs = (char *) jobs;
+		queue.njobs = njobs;
+		queue.job_size = job_size;
+		queue.run = run;
+		queue.next_job = 0;
+		queue.finished = calloc(njobs, sizeof(*queue.finished));
+		workers = calloc(threads, sizeof(*workers));
+
+		if (queue.finished != NULL && workers != NULL) {
+			mutex_init(&queue.lock);
+			cond_init(&queue.job_finished);
+
+			for (started = 0; started < threads; started++) {
+				workers[started].queue = &queue;
+				workers[started].index = started;
+				if (!start_worker(&workers[started]))
+					break;
+			}
+
+			/* Any worker that did start will keep going until all jobs are taken */
+			for (i = 0; i < njobs && started > 0; i++) {
+				mutex_lock(&queue.lock);
+				while (!queue.finished[i])
+					cond_wait(&queue.job_finished, &queue.lock);
+				mutex_unlock(&queue.lock);
+				if (done)
+					done((char *) jobs + i * job_size);
+			}
+
+			for (i = 0; i < started; i++)
+				join_worker(&workers[i]);
+
+			mutex_destroy(&queue.lock);
+			cond_destroy(&queue.job_finished);
+		}
+		free(queue.finished);
+		free(workers);
+
+		if (started > 0)
+			return started;
+	}
+#else
+	(void)threads;
+#endif
+
+	for (i = 0; i < njobs; i++) {
+		run((char *) jobs + i * job_size, 0);
+		if (done)
+			done((char *) jobs + i * job_size);
+	}
+
+	return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <stddef.h>
+
+#define MAX_THREADS 64
+
+/** Runs one job. worker is the index (0..threads-1) of the thread running it */
+typedef void (*job_func)(void *job, int worker);
+/** Called on the calling thread for each finished job, in job order */
+typedef void (*job_done_func)(void *job);
+
+extern int  cpu_count(void);
+extern void lock_shared(void);
+extern void unlock_shared(void);
+extern int  run_jobs(int threads, void *jobs, int njobs, size_t job_size,
+                     job_func run, job_done_func done);
+
+#endif /* THREADS_H */
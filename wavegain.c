@@ -52,6 +52,7 @@
 #include "audio.h"
 #include "dither.h"
 #include "main.h"
+#include "threads.h"
 #include "wavegain.h"
 
 #ifdef _WIN32
@@ -62,22 +63,67 @@
 #include "recurse.h"
 #endif
 
+/* Needs a local round64_t doubletmp and dither_t *dither in scope */
 /*Gcc uses LL as a suffix for long long int (64 bit) types - Marc Brooker 8/4/2004*/
 #ifdef __GNUC__
-#define ROUND64(x)   ( doubletmp = (x) + Dither.Add + (Int64_t)0x001FFFFD80000000LL, *(Int64_t*)(&doubletmp) - (Int64_t)0x433FFFFD80000000LL )
+#define ROUND64(x)   ( doubletmp.d = (x) + dither->Add + (Int64_t)0x001FFFFD80000000LL, doubletmp.i - (Int64_t)0x433FFFFD80000000LL )
 #else
-#define ROUND64(x)   ( doubletmp = (x) + Dither.Add + (Int64_t)0x001FFFFD80000000L, *(Int64_t*)(&doubletmp) - (Int64_t)0x433FFFFD80000000L )
+#define ROUND64(x)   ( doubletmp.d = (x) + dither->Add + (Int64_t)0x001FFFFD80000000L, doubletmp.i - (Int64_t)0x433FFFFD80000000L )
 #endif
 
+typedef union {
+	double  d;
+	Int64_t i;
+} round64_t;
+
+/* Files are only split for analysis if each segment gets at least this many
+ * RMS windows (10 seconds) */
+#define SEGMENT_MIN_WINDOWS      200
+/* RMS windows read before each segment to settle the filters */
+#define SEGMENT_PREROLL_WINDOWS  10
+/* ... and with --loudness, which needs the 3 seconds before a segment for
+ * the short-term blocks ending in it (see SetLoudnessCtx()) */
+#define SEGMENT_LOUDNESS_WINDOWS 64
+/* Samples per channel in each range of a file written by several threads.
+ * Each range has its own dither sequence, so files written by a single thread
+ * restart theirs every as many samples. Must be a multiple of BUFFER_LEN. */
+#define APPLY_RANGE_SAMPLES      (64 * BUFFER_LEN)
+/* analyze_estimate() reads blocks of this many RMS windows (1 second), each
+ * after a few windows to settle the filters, which forget their state by a
+ * factor of 1e9 per window (see gain_analysis.c) */
+#define ESTIMATE_BLOCK_WINDOWS   20
+#define ESTIMATE_PREROLL_WINDOWS 2
+/* Equal parts a file is cut into, each round reads a block from each */
+#define ESTIMATE_STRATA          32
+/* Share of the windows louder than the title gain, and the normal quantile
+ * of a two-sided 95% confidence interval */
+#define ESTIMATE_SHARE           0.05
+#define ESTIMATE_Z               1.96
+/* Sidecar of the histograms of a file for --histogram, see write_histogram() */
+#define HISTOGRAM_SUFFIX         ".wgh"
+#define HISTOGRAM_MAGIC          "WGH1"
+#define HISTOGRAM_HEADER         32	/* Magic, length, peak, true peak, number of histograms */
+#define HISTOGRAM_KINDS          3
+
+/* One part of a file to analyze on a worker thread, see analyze_segments() */
+typedef struct segment_job {
+	const char      *filename;
+	gain_analysis_t *ctx;
+	unsigned long   preroll;	/* First sample read, only to settle the filters */
+	unsigned long   start;		/* First sample of the segment */
+	unsigned long   end;		/* Sample after the last one of the segment */
+	double          peak;
+	double          offset[MAX_CHANNELS];
+	int             result;
+} segment_job;
+
 #ifndef _WIN32
 #define _snprintf snprintf
 #endif
 
 extern int          write_to_log;
-dither_t            Dither;
-double              doubletmp;
 double              total_samples;
-double              total_files;
+double              total_files;	/* Samples per channel written so far, under lock_shared() */
 
 /* Replaced with a double based function for consistency 2005-11-17
 static float FABS(float x)
@@ -98,25 +144,26 @@ static double DABS(double x)
 	return(x);
 }
 
-/* Dither output */
-Int64_t dither_output(int dithering, int shapingtype, int i, double Sum, int k, int format)
+/* Dither output, using (and updating) the dither state of the file being written */
+Int64_t dither_output(dither_t *dither, int dithering, int shapingtype, int i, double Sum, int k, int format)
 {
 	double Sum2;
+	round64_t doubletmp;
 	Int64_t val;
 	if(dithering) {
 		if(!shapingtype) {
-			double  tmp = Random_Equi ( Dither.Dither );
-			Sum2 = tmp - Dither.LastRandomNumber [k];
-			Dither.LastRandomNumber [k] = (int)tmp;
+			double  tmp = Random_Equi ( dither, dither->Dither );
+			Sum2 = tmp - dither->LastRandomNumber [k];
+			dither->LastRandomNumber [k] = (int)tmp;
 			Sum2 = Sum += Sum2;
-			val = ROUND64 (Sum2)  &  Dither.Mask;
+			val = ROUND64 (Sum2)  &  dither->Mask;
 		}
 		else {
-			Sum2  = Random_Triangular ( Dither.Dither ) - scalar16 ( Dither.DitherHistory[k], Dither.FilterCoeff + i );
-			Sum  += Dither.DitherHistory [k] [(-1-i)&15] = (float)Sum2;
-			Sum2  = Sum + scalar16 ( Dither.ErrorHistory [k], Dither.FilterCoeff + i );
-			val = ROUND64 (Sum2)  &  Dither.Mask;
-			Dither.ErrorHistory [k] [(-1-i)&15] = (float)(Sum - val);
+			Sum2  = Random_Triangular ( dither, dither->Dither ) - scalar16 ( dither->DitherHistory[k], dither->FilterCoeff + i );
+			Sum  += dither->DitherHistory [k] [(-1-i)&15] = (float)Sum2;
+			Sum2  = Sum + scalar16 ( dither->ErrorHistory [k], dither->FilterCoeff + i );
+			val = ROUND64 (Sum2)  &  dither->Mask;
+			dither->ErrorHistory [k] [(-1-i)&15] = (float)(Sum - val);
 		}
 	}
 	else
@@ -132,25 +179,402 @@ Int64_t dither_output(int dithering, int shapingtype, int i, double Sum, int k,
 	return (val);
 }
 
-/* Get the gain and peak value for a file. Runs in audiophile mode if 
- * audiophile is true.
+/* Read the next block of up to samples samples of a file being analyzed,
+ * scaled for the analyzer, and add it to the DC offset sums and the peak.
+ * Returns the number of samples read per channel: 0 at the end of the file,
+ * and less than 0 for a stream error, which is not a problem and can be
+ * skipped.
+ */
+
+static long read_analysis_block(wavegain_opt *wg_opts, double **buffer, int samples,
+                                double *offset, double *peak)
+{
+	long samples_read;
+	int  i, j;
+
+	/* Most readers do it all as they decode, touching each sample once */
+	if (wg_opts->read_analysis)
+		return wg_opts->read_analysis(wg_opts->readdata, buffer, samples, offset, peak);
+
+	samples_read = wg_opts->read_samples(wg_opts->readdata, buffer, samples, 0, 0);
+
+	for (i = 0; i < wg_opts->channels; i++) {
+		for (j = 0; j < samples_read; j++) {
+			offset[i] += buffer[i][j];
+			buffer[i][j] *= 0x7fff;
+			if (DABS(buffer[i][j]) > *peak)
+				*peak = DABS(buffer[i][j]);
+		}
+	}
+	return samples_read;
+}
+
+
+/* Analyze one segment of a file, opened on its own so segments can be read
+ * at the same time.
+ */
+
+static void analyze_segment(void *arg, int worker __attribute__((unused)))
+{
+	segment_job   *job = (segment_job *) arg;
+	wavegain_opt  *wg_opts = calloc(1, sizeof(wavegain_opt));
+	FILE          *infile = fopen(job->filename, "rb");
+	input_format  *format = NULL;
+	double        *buffer[MAX_CHANNELS] = {NULL},
+	              preroll_offset[MAX_CHANNELS] = {0.},
+	              preroll_peak = 0.;
+	unsigned long pos = job->preroll;
+	long          samples_read;
+	int           i;
+
+	if (wg_opts == NULL || infile == NULL) {
+		fprintf(stderr, " Not able to open input file %s.\n", job->filename);
+		goto exit;
+	}
+	format = open_audio_file(infile, wg_opts);
+	if (!format || !wg_opts->seek_samples || wg_opts->seek_samples(wg_opts->readdata, pos) != 0) {
+		fprintf(stderr, " Not able to seek in input file %s.\n", job->filename);
+		goto exit;
+	}
+	for (i = 0; i < wg_opts->channels; i++)
+		if ((buffer[i] = malloc(BUFFER_LEN * sizeof(double))) == NULL)
+			goto exit;
+
+	while (pos < job->end) {
+		/* Reads never straddle the start of the segment */
+		unsigned long left = (pos < job->start ? job->start : job->end) - pos;
+		int           in_segment = pos >= job->start;
+
+		samples_read = read_analysis_block(wg_opts, buffer, left < BUFFER_LEN ? (int)left : BUFFER_LEN,
+		                                   in_segment ? job->offset : preroll_offset,
+		                                   in_segment ? &job->peak : &preroll_peak);
+		if (samples_read <= 0)
+			break;
+
+		if (AnalyzeChannelsCtx(job->ctx, (const double **)buffer, samples_read,
+				   wg_opts->channels) != GAIN_ANALYSIS_OK) {
+			fprintf(stderr, " Error processing samples.\n");
+			goto exit;
+		}
+
+		pos += samples_read;
+		if (pos == job->start)
+			DiscardTitleGainCtx(job->ctx);
+	}
+	job->result = 1;
+
+exit:
+	for (i = 0; i < MAX_CHANNELS; i++)
+		if (buffer[i]) free(buffer[i]);
+	if (format)
+		format->close_func(wg_opts->readdata);
+	if (wg_opts)
+		free(wg_opts);
+	if (infile)
+		fclose(infile);
+}
+
+
+/* Analyze a file in up to threads segments at the same time, as explained in
+ * gain_analysis.c. Segments start on RMS window boundaries and read a few
+ * windows ahead, so ctx ends up with the same title histogram as if it had
+ * analyzed the whole file.
  *
- * If an error occured, 0 is returned (a message has been printed).
+ * Returns the number of segments used (the caller must analyze the file
+ * itself if it is 1), or 0 if an error occured.
  */
 
-int get_gain(const char *filename, double *track_peak, double *track_gain, 
-             double *dc_offset, double *offset, SETTINGS *settings)
+static int analyze_segments(const char *filename, gain_analysis_t *ctx, const wavegain_opt *wg_opts,
+                            int threads, const SETTINGS *settings, double *peak, double *offset)
 {
-	wavegain_opt *wg_opts = malloc(sizeof(wavegain_opt));
-	FILE         *infile;
-	int          result = 0;
-	double       new_peak,
-	             factor_clip,
-	             scale,
-	             peak = 0.,
-	             dB;
-	int          k, i;
-	long         chunk;
+	segment_job   *jobs;
+	unsigned long total = wg_opts->total_samples_per_channel;
+	unsigned long window = GetSampleWindowCtx(ctx);
+	unsigned long preroll = settings->loudness ? SEGMENT_LOUDNESS_WINDOWS : SEGMENT_PREROLL_WINDOWS;
+	unsigned long length;
+	int           segments = threads,
+	              result = 0,
+	              i, k;
+
+	if ((unsigned long)segments > total / window / SEGMENT_MIN_WINDOWS)
+		segments = total / window / SEGMENT_MIN_WINDOWS;
+	if (segments > MAX_THREADS)
+		segments = MAX_THREADS;
+	if (segments <= 1 || !wg_opts->seek_samples)
+		return 1;
+
+	if ((jobs = calloc(segments, sizeof(*jobs))) == NULL) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		return 0;
+	}
+
+	length = (total / window + segments - 1) / segments * window;
+	/* The loudness sub-blocks are two windows long */
+	if (settings->loudness && length % (2 * window))
+		length += window;
+	for (i = 0; i < segments; i++) {
+		jobs[i].filename = filename;
+		jobs[i].start = i * length;
+		jobs[i].end = (i == segments - 1) ? total : (i + 1) * length;
+		if (jobs[i].start > preroll * window)
+			jobs[i].preroll = jobs[i].start - preroll * window;
+		/* The first segment needs no preroll, so it goes straight into ctx */
+		jobs[i].ctx = (i == 0) ? ctx : CreateGainAnalysis(wg_opts->rate);
+		if (jobs[i].ctx == NULL) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
+			goto exit;
+		}
+		SetSinglePrecisionCtx(jobs[i].ctx, settings->single);
+		SetPreviewCtx(jobs[i].ctx, settings->preview);
+		SetChannelWeightsCtx(jobs[i].ctx, settings->num_weights ? settings->weights : NULL,
+		                     settings->num_weights);
+		SetTruePeakCtx(jobs[i].ctx, settings->true_peak);
+		if (SetLoudnessCtx(jobs[i].ctx, settings->loudness) != GAIN_ANALYSIS_OK) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
+			goto exit;
+		}
+	}
+
+	run_jobs(segments, jobs, segments, sizeof(*jobs), analyze_segment, NULL);
+
+	for (i = 0; i < segments; i++) {
+		if (!jobs[i].result)
+			goto exit;
+		if (jobs[i].peak > *peak)
+			*peak = jobs[i].peak;
+		for (k = 0; k < wg_opts->channels; k++)
+			offset[k] += jobs[i].offset[k];
+		if (i > 0 && MergeTitleGainAnalysis(ctx, jobs[i].ctx) != GAIN_ANALYSIS_OK) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
+			goto exit;
+		}
+	}
+	result = segments;
+
+exit:
+	for (i = 1; i < segments; i++)
+		if (jobs[i].ctx)
+			DestroyGainAnalysis(jobs[i].ctx);
+	free(jobs);
+	return result;
+}
+
+
+/* Read and analyze block number block (of block_len samples) of a file into
+ * blk, with preroll samples before it, and add its windows to ctx.
+ * Returns the number of samples in the block, or -1 if the file could not be
+ * read or analyzed.
+ */
+
+static long estimate_block(wavegain_opt *wg_opts, gain_analysis_t *ctx, gain_analysis_t *blk,
+                           double **buffer, unsigned long block, unsigned long block_len,
+                           unsigned long preroll, double *peak)
+{
+	unsigned long start = block * block_len,
+	              end = start + block_len,
+	              pos;
+	double        offset[MAX_CHANNELS] = {0.},
+	              preroll_peak = 0.;
+	long          samples_read;
+
+	if (end > wg_opts->total_samples_per_channel)
+		end = wg_opts->total_samples_per_channel;
+	pos = start > preroll ? start - preroll : 0;
+	if (ResetSampleFrequencyCtx(blk, wg_opts->rate) != INIT_GAIN_ANALYSIS_OK
+	    || wg_opts->seek_samples(wg_opts->readdata, pos) != 0)
+		return -1;
+
+	while (pos < end) {
+		/* Reads never straddle the start of the block */
+		unsigned long left = (pos < start ? start : end) - pos;
+
+		samples_read = read_analysis_block(wg_opts, buffer, left < BUFFER_LEN ? (int)left : BUFFER_LEN,
+		                                   offset, pos >= start ? peak : &preroll_peak);
+		if (samples_read <= 0)
+			return -1;
+		if (AnalyzeChannelsCtx(blk, (const double **)buffer, samples_read,
+		                       wg_opts->channels) != GAIN_ANALYSIS_OK)
+			return -1;
+		pos += samples_read;
+		if (pos == start)
+			DiscardTitleGainCtx(blk);
+	}
+	if (MergeTitleGainAnalysis(ctx, blk) != GAIN_ANALYSIS_OK)
+		return -1;
+	return (long)(end - start);
+}
+
+
+/* Work out how far the title gain of the windows read so far may be off, at
+ * 95% confidence. gains receives the windows of ctx, loudest first, and
+ * block_gains holds those of each block read, block k from first[k] on, also
+ * loudest first; blocks of the total in the file have been read.
+ *
+ * The title gain is that of the window at rank ESTIMATE_SHARE of the way
+ * down. How many windows of a block are at least that loud varies from block
+ * to block, and the spread of that share over the blocks read gives the
+ * spread of the ranks the title gain may come from over the whole file.
+ */
+
+static double estimate_error(gain_analysis_t *ctx, double *gains, const double *block_gains,
+                             const long *first, long blocks, long total)
+{
+	long   n = (long)GetTitleWindowGainsCtx(ctx, gains, first[blocks]),
+	       lo, hi, b, i;
+	double gain,
+	       share,
+	       louder,
+	       var = 0.,
+	       se;
+
+	if (n == 0 || blocks < 2)
+		return HUGE_VAL;
+	gain = gains[(long)ceil(n * ESTIMATE_SHARE) - 1];
+	for (i = 0; i < n && gains[i] <= gain; i++)
+		;
+	share = (double)i / n;
+
+	for (b = 0; b < blocks; b++) {
+		for (i = first[b]; i < first[b + 1] && block_gains[i] <= gain; i++)
+			;
+		louder = (i - first[b]) - share * (first[b + 1] - first[b]);
+		var += louder * louder;
+	}
+	se = sqrt(var * blocks / (blocks - 1) * (1. - (double)blocks / total)) / n;
+
+	lo = (long)ceil(n * (ESTIMATE_SHARE - ESTIMATE_Z * se));
+	hi = (long)ceil(n * (ESTIMATE_SHARE + ESTIMATE_Z * se));
+	if (lo < 1)
+		lo = 1;
+	if (hi > n)
+		hi = n;
+	return gain - gains[lo - 1] > gains[hi - 1] - gain ? gain - gains[lo - 1] : gains[hi - 1] - gain;
+}
+
+
+/* Estimate the title gain of a file from blocks of it, for --estimate. The
+ * file is cut into ESTIMATE_STRATA equal parts, and each round reads a block
+ * picked at random from each part, until after a round the title gain of the
+ * windows read is known to within settings->estimate dB (see
+ * estimate_error()). The same file always gives the same blocks. No DC
+ * offset is worked out, and peak only counts the blocks read.
+ *
+ * Returns 1 if the title histogram of ctx holds the windows read, -1 if the
+ * file is too short to be worth it or can't seek (the caller must analyze
+ * it in full), or 0 if an error occured.
+ */
+
+static int analyze_estimate(FILE_LIST *file, gain_analysis_t *ctx, const SETTINGS *settings,
+                            wavegain_opt *wg_opts, double *peak)
+{
+	unsigned long total = wg_opts->total_samples_per_channel,
+	              window = GetSampleWindowCtx(ctx),
+	              block_len = ESTIMATE_BLOCK_WINDOWS * window,
+	              nblocks = (total + block_len - 1) / block_len,
+	              read = 0;
+	unsigned int  seed = (unsigned int)total;
+	gain_analysis_t *blk = NULL;
+	double        *buffer[MAX_CHANNELS] = {NULL},
+	              *gains = NULL,
+	              *block_gains = NULL,
+	              error = HUGE_VAL;
+	long          *first = NULL,
+	              *order = NULL,
+	              blocks = 0,
+	              samples,
+	              taken,
+	              k;
+	int           result = 0,
+	              s, i;
+
+	if (!wg_opts->seek_samples || nblocks < 2 * ESTIMATE_STRATA)
+		return -1;
+
+	blk = CreateGainAnalysis(wg_opts->rate);
+	gains = malloc((nblocks * ESTIMATE_BLOCK_WINDOWS + 1) * sizeof(double));
+	block_gains = malloc((nblocks * ESTIMATE_BLOCK_WINDOWS + 1) * sizeof(double));
+	first = malloc((nblocks + 1) * sizeof(long));
+	order = malloc(nblocks * sizeof(long));
+	if (blk == NULL || gains == NULL || block_gains == NULL || first == NULL || order == NULL) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		goto exit;
+	}
+	for (i = 0; i < wg_opts->channels; i++) {
+		if ((buffer[i] = malloc(BUFFER_LEN * sizeof(double))) == NULL) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
+			goto exit;
+		}
+	}
+	SetSinglePrecisionCtx(blk, settings->single);
+	SetPreviewCtx(blk, settings->preview);
+	SetChannelWeightsCtx(blk, settings->num_weights ? settings->weights : NULL, settings->num_weights);
+	SetTruePeakCtx(blk, settings->true_peak);
+	if (SetLoudnessCtx(blk, settings->loudness) != GAIN_ANALYSIS_OK) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		goto exit;
+	}
+
+	for (k = 0; k < (long)nblocks; k++)
+		order[k] = k;
+	first[0] = 0;
+
+	/* Each part keeps the blocks not read yet after those read, in order.
+	 * The error is only worked out after each round, as it goes over every
+	 * window read. */
+	for (taken = 0; blocks < (long)nblocks && error > settings->estimate; taken++) {
+		for (s = 0; s < ESTIMATE_STRATA; s++) {
+			long start = (long)(s * nblocks / ESTIMATE_STRATA) + taken,
+			     end = (long)((s + 1) * nblocks / ESTIMATE_STRATA),
+			     pick;
+
+			if (start >= end)
+				continue;
+			seed = seed * 1103515245 + 12345;
+			pick = start + (long)((seed >> 16) % (unsigned long)(end - start));
+			k = order[pick];
+			order[pick] = order[start];
+			order[start] = k;
+
+			samples = estimate_block(wg_opts, ctx, blk, buffer, k, block_len,
+			                         ESTIMATE_PREROLL_WINDOWS * window, peak);
+			if (samples < 0) {
+				fprintf(stderr, " Not able to read input file %s.\n", file->filename);
+				goto exit;
+			}
+			read += samples;
+			first[blocks + 1] = first[blocks] + (long)GetTitleWindowGainsCtx(blk, block_gains + first[blocks],
+			                                                                  ESTIMATE_BLOCK_WINDOWS);
+			blocks++;
+		}
+		error = estimate_error(ctx, gains, block_gains, first, blocks, nblocks);
+	}
+
+	file->error = error;
+	file->share = (double)read / total;
+	result = 1;
+
+exit:
+	for (i = 0; i < MAX_CHANNELS; i++)
+		if (buffer[i]) free(buffer[i]);
+	if (order) free(order);
+	if (first) free(first);
+	if (block_gains) free(block_gains);
+	if (gains) free(gains);
+	if (blk)
+		DestroyGainAnalysis(blk);
+	return result;
+}
+
+
+/* Open a file for analysis and start a new title in ctx, keeping the album
+ * data. Returns the input format, or NULL if the file can't be analyzed (a
+ * message has been printed, and *infile may still need closing).
+ */
+
+static input_format *open_analysis(FILE_LIST *file, gain_analysis_t *ctx, const SETTINGS *settings,
+                                   wavegain_opt *wg_opts, FILE **infile)
+{
+	const char   *filename = file->filename;
 	input_format *format;
 
 	memset(wg_opts, 0, sizeof(wavegain_opt));
@@ -158,19 +582,18 @@ int get_gain(const char *filename, double *track_peak, double *track_gain,
 	wg_opts->force = settings->force;
 
 	if(!strcmp(filename, "-")) {
-		infile = stdin;
-		settings->apply_gain = 0;
+		*infile = stdin;
 		wg_opts->std_in = 1;
 #ifdef _WIN32
 		_setmode( _fileno(stdin), _O_BINARY );
 #endif
 	}
 	else
-		infile = fopen(filename, "rb");
+		*infile = fopen(filename, "rb");
 
-	if (infile == NULL) {
+	if (*infile == NULL) {
 		fprintf (stderr, " Not able to open input file %s.\n", filename) ;
-		goto exit;
+		return NULL;
 	}
 	wg_opts->apply_gain = 0;
 
@@ -178,53 +601,354 @@ int get_gain(const char *filename, double *track_peak, double *track_gain,
 	 * Now, we need to select an input audio format
 	 */
 
-	format = open_audio_file(infile, wg_opts);
+	format = open_audio_file(*infile, wg_opts);
 	if (!format) {
 		/* error reported by reader */
 		fprintf (stderr, " Unrecognized file format for %s.\n", filename);
-		goto exit;
+		return NULL;
 	}
 
 	if (wg_opts->gain_chunk == 1 && !wg_opts->force) {
 		fprintf (stderr, " Skipping File %s, it has already been processed.\n", filename);
-//		result = 1;
-		goto exit;
+		format->close_func(wg_opts->readdata);
+		return NULL;
 	}
 
-	if ((wg_opts->channels != 1) && (wg_opts->channels != 2)) {
+	if (wg_opts->channels < 1 || wg_opts->channels > MAX_CHANNELS) {
 		fprintf(stderr, " Unsupported number of channels (%d) for %s.\n",
 				wg_opts->channels, filename);
+		format->close_func(wg_opts->readdata);
+		return NULL;
+	}
+
+	/* Start a new title, keeping the album data */
+	if (ResetSampleFrequencyCtx(ctx, wg_opts->rate) != INIT_GAIN_ANALYSIS_OK) {
+		fprintf(stderr, " Error Initializing Gain Analysis (samplerate out of range?)\n");
+		format->close_func(wg_opts->readdata);
+		return NULL;
+	}
+
+	file->samples = (double)wg_opts->total_samples_per_channel;
+	file->share = 0.;
+	return format;
+}
+
+
+/* Numbers in the histogram sidecars are little-endian, doubles going as
+ * their IEEE 754 bits */
+
+static void put_u32(unsigned char *buf, unsigned long x)
+{
+	buf[0] = (unsigned char)(x & 0xff);
+	buf[1] = (unsigned char)((x >> 8) & 0xff);
+	buf[2] = (unsigned char)((x >> 16) & 0xff);
+	buf[3] = (unsigned char)((x >> 24) & 0xff);
+}
+
+static unsigned long get_u32(const unsigned char *buf)
+{
+	return (unsigned long)buf[0] | ((unsigned long)buf[1] << 8)
+	       | ((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
+}
+
+static void put_double(unsigned char *buf, double x)
+{
+	Uint64_t bits;
+
+	memcpy(&bits, &x, sizeof(bits));
+	put_u32(buf, (unsigned long)(bits & 0xffffffff));
+	put_u32(buf + 4, (unsigned long)(bits >> 32));
+}
+
+static double get_double(const unsigned char *buf)
+{
+	Uint64_t bits = (Uint64_t)get_u32(buf) | ((Uint64_t)get_u32(buf + 4) << 32);
+	double   x;
+
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+
+/* Histograms the sidecars may hold, in the order they are written */
+static const int histogram_kinds[HISTOGRAM_KINDS] = {
+	GAIN_HISTOGRAM_WINDOWS, GAIN_HISTOGRAM_BLOCKS, GAIN_HISTOGRAM_SHORT
+};
+
+
+/* Write the histograms of the current title of ctx, and the length and peaks
+ * of the file, to file->filename with HISTOGRAM_SUFFIX added, for
+ * --histogram; merge_histograms() adds such sidecars up later, on any
+ * machine, as if their files had been analyzed together. A sidecar is
+ * HISTOGRAM_MAGIC, the samples per channel, the sample peak and the true
+ * peak (NO_PEAK if not measured) as doubles, the number of histograms, then
+ * for each its kind (GAIN_HISTOGRAM_...) and number of steps used, and that
+ * many steps and counts (see GetTitleHistogramCtx()); all but the doubles
+ * are 32 bit. The loudness histograms are only there with --loudness.
+ *
+ * Returns 1 if successful, 0 if not (a message has been printed).
+ */
+
+static int write_histogram(const FILE_LIST *file, const gain_analysis_t *ctx, const SETTINGS *settings,
+                           double peak)
+{
+	unsigned int  *steps = NULL,
+	              *counts = NULL;
+	unsigned char *buf = NULL,
+	              *p;
+	size_t        n[HISTOGRAM_KINDS],
+	              total = 0,
+	              k;
+	char          *name = NULL;
+	FILE          *out = NULL;
+	int           kinds = settings->loudness ? HISTOGRAM_KINDS : 1,
+	              result = 0,
+	              i;
+
+	if (!strcmp(file->filename, "-")) {
+		fprintf(stderr, " No histogram written for standard input.\n");
+		return 1;
+	}
+
+	for (i = 0; i < kinds; i++)
+		total += n[i] = GetTitleHistogramCtx(ctx, histogram_kinds[i], NULL, NULL, 0);
+	name = malloc(strlen(file->filename) + sizeof(HISTOGRAM_SUFFIX));
+	buf = malloc(HISTOGRAM_HEADER + kinds * 8 + total * 8);
+	steps = malloc((total + 1) * sizeof(*steps));
+	counts = malloc((total + 1) * sizeof(*counts));
+	if (name == NULL || buf == NULL || steps == NULL || counts == NULL) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		goto exit;
+	}
+	strcpy(name, file->filename);
+	strcat(name, HISTOGRAM_SUFFIX);
+
+	memcpy(buf, HISTOGRAM_MAGIC, 4);
+	put_double(buf + 4, file->samples);
+	put_double(buf + 12, peak);
+	put_double(buf + 20, settings->true_peak ? GetTruePeakCtx(ctx) : NO_PEAK);
+	put_u32(buf + 28, kinds);
+	p = buf + HISTOGRAM_HEADER;
+	for (i = 0; i < kinds; i++) {
+		GetTitleHistogramCtx(ctx, histogram_kinds[i], steps, counts, n[i]);
+		put_u32(p, histogram_kinds[i]);
+		put_u32(p + 4, (unsigned long)n[i]);
+		p += 8;
+		for (k = 0; k < n[i]; k++, p += 8) {
+			put_u32(p, steps[k]);
+			put_u32(p + 4, counts[k]);
+		}
+	}
+
+	if ((out = fopen(name, "wb")) == NULL
+	    || fwrite(buf, 1, p - buf, out) != (size_t)(p - buf)) {
+		fprintf(stderr, " Not able to write histogram file %s.\n", name);
+		goto exit;
+	}
+	result = 1;
+
+exit:
+	if (out && fclose(out) != 0 && result) {
+		fprintf(stderr, " Not able to write histogram file %s.\n", name);
+		result = 0;
+	}
+	free(name);
+	free(buf);
+	free(steps);
+	free(counts);
+	return result;
+}
+
+
+/* Read a sidecar written by write_histogram(), named file->filename, into
+ * the current title of ctx, its length into file and its peak (the true
+ * peak with --true-peak, see finish_analysis()) into *peak. The loudness
+ * histograms are only read with --loudness, and must be there then.
+ *
+ * Returns 1 if successful, 0 if not (a message has been printed).
+ */
+
+static int read_histogram(FILE_LIST *file, gain_analysis_t *ctx, const SETTINGS *settings, double *peak)
+{
+	unsigned int  *steps = NULL,
+	              *counts = NULL;
+	unsigned char *buf = NULL,
+	              *p,
+	              *end;
+	unsigned long kinds,
+	              kind,
+	              n,
+	              k;
+	double        true_peak;
+	FILE          *in;
+	long          size = -1;
+	int           found = 0,
+	              result = 0,
+	              i;
+
+	if ((in = fopen(file->filename, "rb")) == NULL) {
+		fprintf(stderr, " Not able to open input file %s.\n", file->filename);
+		return 0;
+	}
+	if (fseek(in, 0, SEEK_END) == 0 && (size = ftell(in)) >= 0 && fseek(in, 0, SEEK_SET) == 0
+	    && (buf = malloc(size + 1)) != NULL && fread(buf, 1, size, in) != (size_t)size)
+		size = -1;
+	fclose(in);
+	if (buf == NULL || size < 0) {
+		fprintf(stderr, " Not able to read input file %s.\n", file->filename);
 		goto exit;
 	}
 
-	/* Only initialize gain analysis once in audiophile mode */
-	if (settings->first_file || !settings->audiophile) {
-		if (InitGainAnalysis(wg_opts->rate) != INIT_GAIN_ANALYSIS_OK) {
-			fprintf(stderr, " Error Initializing Gain Analysis (non-standard samplerate?)\n");
+	end = buf + size;
+	if (size < HISTOGRAM_HEADER || memcmp(buf, HISTOGRAM_MAGIC, 4))
+		goto invalid;
+	file->samples = get_double(buf + 4);
+	*peak = get_double(buf + 12);
+	true_peak = get_double(buf + 20);
+	kinds = get_u32(buf + 28);
+	for (p = buf + HISTOGRAM_HEADER; kinds > 0; kinds--) {
+		if (end - p < 8)
+			goto invalid;
+		kind = get_u32(p);
+		n = get_u32(p + 4);
+		p += 8;
+		if ((unsigned long)(end - p) / 8 < n)
+			goto invalid;
+		for (i = 0; i < HISTOGRAM_KINDS && histogram_kinds[i] != (int)kind; i++)
+			;
+		if (i == HISTOGRAM_KINDS)
+			goto invalid;
+		found |= 1 << i;
+		if (kind != GAIN_HISTOGRAM_WINDOWS && !settings->loudness) {
+			p += n * 8;
+			continue;
+		}
+
+		free(steps);
+		free(counts);
+		steps = malloc((n + 1) * sizeof(*steps));
+		counts = malloc((n + 1) * sizeof(*counts));
+		if (steps == NULL || counts == NULL) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
 			goto exit;
 		}
-	}
-    
-	if (settings->first_file) {
-		total_samples = (double)wg_opts->total_samples_per_channel;
-		fprintf(stderr, "\n Analyzing...\n\n");
-		fprintf(stderr, "    Gain   |  Peak  | Scale | New Peak |Left DC|Right DC| Track\n");
-		fprintf(stderr, "           |        |       |          |Offset | Offset |\n");
-		fprintf(stderr, " --------------------------------------------------------------\n");
-		if(write_to_log) {
-			write_log("\n Analyzing...\n\n");
-			write_log("    Gain   |  Peak  | Scale | New Peak |Left DC|Right DC| Track\n");
-			write_log("           |        |       |          |Offset | Offset |\n");
-			write_log(" --------------------------------------------------------------\n");
+		for (k = 0; k < n; k++, p += 8) {
+			steps[k] = get_u32(p);
+			counts[k] = get_u32(p + 4);
 		}
-		settings->first_file = 0;
+		if (AddTitleHistogramCtx(ctx, (int)kind, steps, counts, n) != GAIN_ANALYSIS_OK)
+			goto invalid;
 	}
-	else
-		total_samples += (double)wg_opts->total_samples_per_channel;
+	if (!(found & 1) || !(*peak >= 0.))
+		goto invalid;
+	if (settings->loudness && found != (1 << HISTOGRAM_KINDS) - 1) {
+		fprintf(stderr, " No loudness in histogram file %s, write it with --loudness.\n", file->filename);
+		goto exit;
+	}
+	if (settings->true_peak) {
+		if (true_peak == NO_PEAK)
+			fprintf(stderr, " No true peak in histogram file %s, using the sample peak.\n", file->filename);
+		else if (true_peak > *peak)
+			*peak = true_peak;
+	}
+	result = 1;
+	goto exit;
+
+invalid:
+	fprintf(stderr, " %s is not a WaveGain histogram file.\n", file->filename);
+exit:
+	free(buf);
+	free(steps);
+	free(counts);
+	return result;
+}
 
-	if (settings->fast && (wg_opts->total_samples_per_channel * (wg_opts->samplesize / 8)
-			* wg_opts->channels > 8192000)) {
 
+/* Work out the track gain, scale and peak of an analyzed file, and write its
+ * histograms with --histogram.
+ *
+ * Returns 1 if successful, 0 if not (a message has been printed).
+ */
+
+static int finish_analysis(FILE_LIST *file, gain_analysis_t *ctx, const SETTINGS *settings, double peak)
+{
+	double factor_clip,
+	       scale;
+
+	if (settings->histogram && !write_histogram(file, ctx, settings, peak))
+		return 0;
+
+	/* The interpolated samples need not go through the samples exactly,
+	 * so the larger of the two peaks counts */
+	if (settings->true_peak && GetTruePeakCtx(ctx) > peak)
+		peak = GetTruePeakCtx(ctx);
+	if (settings->loudness) {
+		Float_t range;
+
+		file->loudness = GetTitleLoudnessCtx(ctx, &range);
+		file->loudness_range = range;
+	}
+
+	/*
+	 * calculate factors for ReplayGain and ClippingPrevention
+	 */
+	file->track_gain = (GetTitleGainCtx(ctx) + settings->man_gain);
+	scale = (pow(10., file->track_gain * 0.05));
+	if(settings->clip_prev) {
+		factor_clip  = (32767./( peak + 1));
+		if(scale < factor_clip)
+			factor_clip = 1.0;
+		else
+			factor_clip /= scale;
+		scale *= factor_clip;
+	}
+	file->peak = peak;
+	file->scale = scale;
+	file->track_peak = (peak * scale);
+	file->track_gain = 20. * log10(scale);
+	return 1;
+}
+
+
+/* Get the gain and peak value for a file, using the analyzer ctx. The file
+ * is also added to the album data of ctx, see GetAlbumGainCtx().
+ *
+ * Results are stored in file; nothing is printed except error messages and
+ * settings is not modified, so several files may be analyzed at once, each
+ * with its own ctx. Use report_gain() to print the results.
+ *
+ * Long files are split over up to threads threads, see analyze_segments().
+ *
+ * If an error occured, 0 is returned (a message has been printed).
+ */
+
+int analyze_gain(FILE_LIST *file, gain_analysis_t *ctx, const SETTINGS *settings, int threads)
+{
+	const char   *filename = file->filename;
+	wavegain_opt *wg_opts = malloc(sizeof(wavegain_opt));
+	FILE         *infile = NULL;
+	int          result = 0;
+	double       peak = 0.,
+	             *offset = file->offset,
+	             *dc_offset = file->dc_offset;
+	int          k, i, segments;
+	long         chunk;
+	input_format *format = NULL;
+
+	if (wg_opts == NULL)
+		goto exit;
+	format = open_analysis(file, ctx, settings, wg_opts, &infile);
+	if (!format)
+		goto exit;
+
+	if (settings->estimate > 0.
+	    && (result = analyze_estimate(file, ctx, settings, wg_opts, &peak)) != -1) {
+		if (!result)
+			goto exit;
+		result = 0;
+	}
+	else if (settings->fast && (wg_opts->total_samples_per_channel * (wg_opts->samplesize / 8)
+			* wg_opts->channels > 8192000)) {
 		long samples_read;
 		double **buffer = malloc(sizeof(double *) * wg_opts->channels);
 
@@ -258,7 +982,7 @@ int get_gain(const char *filename, double *track_peak, double *track_gain,
 						}
 					}
 
-					if (AnalyzeSamples(buffer[0], buffer[1], samples_read,
+					if (AnalyzeChannelsCtx(ctx, (const double **)buffer, samples_read,
 							   wg_opts->channels) != GAIN_ANALYSIS_OK) {
 						fprintf(stderr, " Error processing samples.\n");
 						for (i = 0; i < wg_opts->channels; i++)
@@ -273,6 +997,13 @@ int get_gain(const char *filename, double *track_peak, double *track_gain,
 			if (buffer[i]) free(buffer[i]);
 		if (buffer) free(buffer);
 	}
+	else if ((segments = analyze_segments(filename, ctx, wg_opts, threads, settings,
+			&peak, offset)) != 1) {
+		if (!segments)
+			goto exit;
+		for (i = 0; i < wg_opts->channels; i++)
+			dc_offset[i] = (double)(offset[i] / wg_opts->total_samples_per_channel);
+	}
 	else
 	{
 		long samples_read;
@@ -281,41 +1012,17 @@ int get_gain(const char *filename, double *track_peak, double *track_gain,
 		for (i = 0; i < wg_opts->channels; i++)
 			buffer[i] = malloc(BUFFER_LEN * sizeof(double));
 
-		while (1) {
-
-			samples_read = wg_opts->read_samples(wg_opts->readdata, buffer, BUFFER_LEN, 0, 0);
-
-			if (samples_read == 0) {
-				break;
-			} 
-			else {
-				if (samples_read < 0) {
-					/* Error in the stream. Not a problem, just reporting it in case 
-					 * we (the app) cares. In this case, we don't
-					 */
-				} 
-				else {
-					int i;
-					int j;
-
-					for (i = 0; i < wg_opts->channels; i++) {
-						for (j = 0; j < samples_read; j++) {
-							offset[i] += buffer[i][j];
-							buffer[i][j] *= 0x7fff;
-							if (DABS(buffer[i][j]) > peak)
-								peak = DABS(buffer[i][j]);
-						}
-					}
-
-					if (AnalyzeSamples(buffer[0], buffer[1], samples_read,
-							   wg_opts->channels) != GAIN_ANALYSIS_OK) {
-						fprintf(stderr, " Error processing samples.\n");
-						for (i = 0; i < wg_opts->channels; i++)
-							if (buffer[i]) free(buffer[i]);
-						if (buffer) free(buffer);
-						goto exit;
-					}
-				}
+		while ((samples_read = read_analysis_block(wg_opts, buffer, BUFFER_LEN, offset, &peak)) != 0) {
+			/* A stream error (samples_read < 0) is not a problem, just
+			 * reported in case we (the app) care. In this case, we don't
+			 */
+			if (samples_read > 0 && AnalyzeChannelsCtx(ctx, (const double **)buffer, samples_read,
+					   wg_opts->channels) != GAIN_ANALYSIS_OK) {
+				fprintf(stderr, " Error processing samples.\n");
+				for (i = 0; i < wg_opts->channels; i++)
+					if (buffer[i]) free(buffer[i]);
+				if (buffer) free(buffer);
+				goto exit;
 			}
 		}
 
@@ -325,55 +1032,617 @@ int get_gain(const char *filename, double *track_peak, double *track_gain,
 		}
 		if (buffer) free(buffer);
 	}
-	/*
-	 * calculate factors for ReplayGain and ClippingPrevention
-	 */
-	*track_gain = (GetTitleGain() + settings->man_gain);
-	scale = (pow(10., *track_gain * 0.05));
-	if(settings->clip_prev) {
-		factor_clip  = (32767./( peak + 1));
-		if(scale < factor_clip)
-			factor_clip = 1.0;
-		else
-			factor_clip /= scale;
-		scale *= factor_clip;
+	if (!finish_analysis(file, ctx, settings, peak))
+		goto exit;
+	result = 1;
+
+exit:
+	if (format)
+		format->close_func(wg_opts->readdata);
+	if (wg_opts)
+		free(wg_opts);
+	if (infile)
+		fclose(infile);
+	return result;
+}
+
+
+/* Follow the track gain of a file or stream as it is read, for --monitor:
+ * every settings->interval seconds the gain of the last settings->monitor
+ * seconds is written to stdout, as the time in seconds and the gain in dB.
+ * The analyzer only keeps that many RMS windows (see
+ * SetTitleWindowLimitCtx()), so a stream can go on for as long as it likes.
+ *
+ * If an error occured, 0 is returned (a message has been printed).
+ */
+
+int monitor_gain(FILE_LIST *file, const SETTINGS *settings)
+{
+	wavegain_opt    *wg_opts = malloc(sizeof(wavegain_opt));
+	gain_analysis_t *ctx = CreateGainAnalysis(0);
+	FILE            *infile = NULL;
+	input_format    *format = NULL;
+	double          *buffer[MAX_CHANNELS] = {NULL},
+	                offset[MAX_CHANNELS] = {0.},
+	                peak = 0.,
+	                gain;
+	unsigned long   interval,
+	                next,
+	                pos = 0;
+	long            samples_read;
+	int             result = 0,
+	                i;
+
+	if (wg_opts == NULL || ctx == NULL) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		goto exit;
+	}
+	SetSinglePrecisionCtx(ctx, settings->single);
+	SetPreviewCtx(ctx, settings->preview);
+	SetChannelWeightsCtx(ctx, settings->num_weights ? settings->weights : NULL, settings->num_weights);
+	format = open_analysis(file, ctx, settings, wg_opts, &infile);
+	if (!format)
+		goto exit;
+	if (SetTitleWindowLimitCtx(ctx, (size_t)ceil(settings->monitor * wg_opts->rate
+	                                             / GetSampleWindowCtx(ctx))) != GAIN_ANALYSIS_OK) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		goto exit;
+	}
+	for (i = 0; i < wg_opts->channels; i++) {
+		if ((buffer[i] = malloc(BUFFER_LEN * sizeof(double))) == NULL) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
+			goto exit;
+		}
 	}
-	new_peak = (peak * scale);
 
-        dB = 20. * log10(scale);
-	*track_gain = dB;
-	{
-		int dc_l;
-		int dc_r;
-		if (settings->no_offset) {
-			dc_l = 0;
-			dc_r = 0;
+	interval = (unsigned long)(settings->interval * wg_opts->rate + .5);
+	if (interval < 1)
+		interval = 1;
+	next = interval;
+	fprintf(stderr, "\n Monitoring %s, gain of the last %g seconds every %g seconds...\n\n",
+		file->filename, settings->monitor, settings->interval);
+
+	for (;;) {
+		unsigned long left = next - pos;
+
+		samples_read = read_analysis_block(wg_opts, buffer, left < BUFFER_LEN ? (int)left : BUFFER_LEN,
+		                                   offset, &peak);
+		if (samples_read == 0)
+			break;
+		/* A stream error is not a problem, see analyze_gain() */
+		if (samples_read < 0)
+			continue;
+		if (AnalyzeChannelsCtx(ctx, (const double **)buffer, samples_read,
+		                       wg_opts->channels) != GAIN_ANALYSIS_OK) {
+			fprintf(stderr, " Error processing samples.\n");
+			goto exit;
 		}
-		else {
-			dc_l = (int)(dc_offset[0] * 32768 * -1);
-			dc_r = (int)(dc_offset[1] * 32768 * -1);
+		pos += samples_read;
+		if (pos == next) {
+			next += interval;
+			if ((gain = PeekTitleGainCtx(ctx)) == GAIN_NOT_ENOUGH_SAMPLES)
+				continue;
+			fprintf(stdout, "%.1lf\t%+.2lf\n", (double)pos / wg_opts->rate, gain + settings->man_gain);
+			fflush(stdout);
+			if(write_to_log)
+				write_log(" %10.1lf s | %+6.2lf dB | %s\n", (double)pos / wg_opts->rate,
+					gain + settings->man_gain, file->filename);
 		}
-		fprintf(stderr, " %+6.2lf dB | %6.0lf | %5.2lf | %8.0lf | %4d  |  %4d  | %s\n",
-			*track_gain, peak, scale, new_peak, dc_l, dc_r, filename);
+	}
+	result = 1;
+
+exit:
+	for (i = 0; i < MAX_CHANNELS; i++)
+		if (buffer[i]) free(buffer[i]);
+	if (format)
+		format->close_func(wg_opts->readdata);
+	if (wg_opts)
+		free(wg_opts);
+	if (infile)
+		fclose(infile);
+	if (ctx)
+		DestroyGainAnalysis(ctx);
+	return result;
+}
+
+
+/* One file of analyze_gains() */
+typedef struct batch_track
+{
+	wavegain_opt  wg_opts;
+	FILE          *infile;
+	input_format  *format;
+	double        *buffer[MAX_CHANNELS];
+	double        peak;
+	long          samples_read;
+	int           active;       /**< Still being read */
+} batch_track;
+
+
+/* Analyze count files (up to GAIN_BATCH_MAX) at the same time, file i with
+ * analyzer ctx[i]. Each file is read a block at a time in turn, and the
+ * blocks go through AnalyzeSamplesBatch(), which filters files at the same
+ * rate side by side in the lanes of a vector register. Files with more than
+ * two channels are analyzed on their own, a block at a time as well. The
+ * results are the same as analyze_gain() would give with one thread (give or
+ * take the last bits of the filters, see gain_analysis.c).
+ *
+ * results[i] is set to 1 if file i was analyzed and 0 if not (a message has
+ * been printed). Returns the number of files analyzed.
+ */
+
+int analyze_gains(FILE_LIST **files, gain_analysis_t **ctx, int count, const SETTINGS *settings,
+                  int *results)
+{
+	batch_track     *tracks = calloc(count, sizeof(*tracks));
+	gain_analysis_t *batch[GAIN_BATCH_MAX];
+	const double    *left[GAIN_BATCH_MAX];
+	const double    *right[GAIN_BATCH_MAX];
+	const double    *rest[MAX_CHANNELS];
+	long            common;
+	long            skip;
+	int             active = 0,
+	                analyzed = 0,
+	                n, i, k;
+
+	if (tracks == NULL || count > GAIN_BATCH_MAX) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		free(tracks);
+		for (k = 0; k < count; k++)
+			results[k] = 0;
+		return 0;
+	}
+
+	for (k = 0; k < count; k++) {
+		batch_track *t = &tracks[k];
+
+		results[k] = 0;
+		t->format = open_analysis(files[k], ctx[k], settings, &t->wg_opts, &t->infile);
+		if (!t->format)
+			continue;
+		for (i = 0; i < t->wg_opts.channels; i++)
+			if ((t->buffer[i] = malloc(BUFFER_LEN * sizeof(double))) == NULL)
+				break;
+		if (i < t->wg_opts.channels) {
+			fprintf(stderr, " Error allocating memory for analysis\n");
+			t->format->close_func(t->wg_opts.readdata);
+			continue;
+		}
+		t->active = 1;
+		active++;
+	}
+
+	while (active > 0) {
+		/* Read a block of each file, and analyze the part they all have */
+		common = BUFFER_LEN;
+		for (k = 0; k < count; k++) {
+			batch_track *t = &tracks[k];
+
+			if (!t->active)
+				continue;
+			t->samples_read = read_analysis_block(&t->wg_opts, t->buffer, BUFFER_LEN, files[k]->offset, &t->peak);
+			if (t->samples_read == 0) {
+				for (i = 0; i < t->wg_opts.channels; i++)
+					files[k]->dc_offset[i] = (double)(files[k]->offset[i] / t->wg_opts.total_samples_per_channel);
+				results[k] = finish_analysis(files[k], ctx[k], settings, t->peak);
+				if (!results[k])
+					t->format->close_func(t->wg_opts.readdata);
+				analyzed += results[k];
+				t->active = 0;
+				active--;
+			}
+			else if (t->samples_read > 0 && t->samples_read < common && t->wg_opts.channels <= 2)
+				common = t->samples_read;
+		}
+
+		for (k = 0, n = 0; k < count; k++) {
+			if (!tracks[k].active || tracks[k].samples_read <= 0 || tracks[k].wg_opts.channels > 2)
+				continue;
+			batch[n] = ctx[k];
+			left[n] = tracks[k].buffer[0];
+			right[n] = tracks[k].wg_opts.channels == 2 ? tracks[k].buffer[1] : NULL;
+			n++;
+		}
+		if (n > 0 && AnalyzeSamplesBatch(batch, left, right, n, common) != GAIN_ANALYSIS_OK)
+			break;
+
+		/* Files that read more (i.e. a last, shorter block elsewhere) do the rest on their own */
+		for (k = 0; k < count; k++) {
+			batch_track *t = &tracks[k];
+
+			skip = t->wg_opts.channels <= 2 ? common : 0;
+			if (!t->active || t->samples_read <= skip)
+				continue;
+			for (i = 0; i < t->wg_opts.channels; i++)
+				rest[i] = t->buffer[i] + skip;
+			if (AnalyzeChannelsCtx(ctx[k], rest, t->samples_read - skip, t->wg_opts.channels) != GAIN_ANALYSIS_OK)
+				break;
+		}
+		if (k < count)
+			break;
+	}
+	if (active > 0)
+		fprintf(stderr, " Error processing samples.\n");
+
+	for (k = 0; k < count; k++) {
+		batch_track *t = &tracks[k];
+
+		for (i = 0; i < MAX_CHANNELS; i++)
+			if (t->buffer[i]) free(t->buffer[i]);
+		if (t->format && (t->active || results[k]))
+			t->format->close_func(t->wg_opts.readdata);
+		if (t->infile)
+			fclose(t->infile);
+	}
+	free(tracks);
+	return analyzed;
+}
+
+
+/* Print the results of analyze_gain() for a file, and add them to the totals
+ * kept in settings. Files must be reported in the order they are to be
+ * listed.
+ */
+
+void report_gain(FILE_LIST *file, SETTINGS *settings)
+{
+	int dc_l;
+	int dc_r;
+
+	if(!strcmp(file->filename, "-"))
+		settings->apply_gain = 0;
+
+	if (settings->first_file) {
+		total_samples = file->samples;
+		fprintf(stderr, "\n Analyzing...\n\n");
+		fprintf(stderr, "    Gain   |%s| Scale | New Peak |Left DC|Right DC| Track\n",
+			settings->true_peak ? " TruePk " : "  Peak  ");
+		fprintf(stderr, "           |        |       |          |Offset | Offset |\n");
+		fprintf(stderr, " --------------------------------------------------------------\n");
 		if(write_to_log) {
-			write_log(" %+6.2lf dB | %6.0lf | %5.2lf | %8.0lf | %4d  |  %4d  | %s\n",
-				*track_gain, peak, scale, new_peak, dc_l, dc_r, filename);
+			write_log("\n Analyzing...\n\n");
+			write_log("    Gain   |%s| Scale | New Peak |Left DC|Right DC| Track\n",
+				settings->true_peak ? " TruePk " : "  Peak  ");
+			write_log("           |        |       |          |Offset | Offset |\n");
+			write_log(" --------------------------------------------------------------\n");
+		}
+		settings->first_file = 0;
+	}
+	else
+		total_samples += file->samples;
+
+	if (settings->no_offset) {
+		dc_l = 0;
+		dc_r = 0;
+	}
+	else {
+		dc_l = (int)(file->dc_offset[0] * 32768 * -1);
+		dc_r = (int)(file->dc_offset[1] * 32768 * -1);
+	}
+	fprintf(stderr, " %+6.2lf dB | %6.0lf | %5.2lf | %8.0lf | %4d  |  %4d  | %s\n",
+		file->track_gain, file->peak, file->scale, file->track_peak, dc_l, dc_r, file->filename);
+	if(write_to_log) {
+		write_log(" %+6.2lf dB | %6.0lf | %5.2lf | %8.0lf | %4d  |  %4d  | %s\n",
+			file->track_gain, file->peak, file->scale, file->track_peak, dc_l, dc_r, file->filename);
+	}
+	if (file->share > 0.) {
+		fprintf(stderr, "  +/-%4.2lf dB |        |       |          |       |        | from %.0lf%% of the file\n",
+			file->error, file->share * 100.);
+		if(write_to_log)
+			write_log("  +/-%4.2lf dB |        |       |          |       |        | from %.0lf%% of the file\n",
+				file->error, file->share * 100.);
+	}
+	if (settings->loudness) {
+		double loudness = file->loudness == GAIN_NOT_ENOUGH_SAMPLES ? -HUGE_VAL : file->loudness;
+
+		/* The blocks of an estimate are too short for a loudness range */
+		if (file->share > 0.) {
+			fprintf(stderr, " %5.1lf LUFS|        |       |          |       |        | of the parts read\n",
+				loudness);
+			if(write_to_log)
+				write_log(" %5.1lf LUFS|        |       |          |       |        | of the parts read\n",
+					loudness);
+		}
+		else {
+			fprintf(stderr, " %5.1lf LUFS|        |       |          |       |        | LRA %.1lf LU\n",
+				loudness, file->loudness_range);
+			if(write_to_log)
+				write_log(" %5.1lf LUFS|        |       |          |       |        | LRA %.1lf LU\n",
+					loudness, file->loudness_range);
 		}
 	}
 	if (settings->scale && !settings->audiophile)
-		fprintf(stdout, "%8.6lf", scale);
+		fprintf(stdout, "%8.6lf", file->scale);
+
+	settings->album_peak = settings->album_peak < file->peak ? file->peak : settings->album_peak;
+}
+
+
+/* Add up the histogram sidecars in file_list (see write_histogram()) into an
+ * album, for --merge: each is listed with report_gain() as its file was when
+ * analyzed, and the album gain and loudness come out as if all the files had
+ * been analyzed together. Sidecars that couldn't be read get their filename
+ * set to NULL, as in analyze_files().
+ *
+ * Returns 0 if successful and -1 if an error occured or no sidecar could be
+ * read (in which case a message has been printed).
+ */
+
+int merge_histograms(FILE_LIST *file_list, SETTINGS *settings, double *album_gain, double *album_loudness)
+{
+	/* No samples are analyzed, so the rate is only there to set ctx up */
+	gain_analysis_t *ctx = CreateGainAnalysis(48000);
+	FILE_LIST       *file;
+	double          peak;
+	Float_t         range;
+	int             merged = 0;
+
+	if (ctx == NULL || SetLoudnessCtx(ctx, settings->loudness) != GAIN_ANALYSIS_OK) {
+		fprintf(stderr, " Error allocating memory for analysis\n");
+		if (ctx)
+			DestroyGainAnalysis(ctx);
+		return -1;
+	}
+
+	for (file = file_list; file; file = file->next_file) {
+		if (file->filename == NULL)
+			continue;
+		if (!read_histogram(file, ctx, settings, &peak)) {
+			DiscardTitleGainCtx(ctx);
+			file->filename = NULL;
+			continue;
+		}
+		finish_analysis(file, ctx, settings, peak);
+		report_gain(file, settings);
+		merged++;
+	}
+	if (!merged) {
+		DestroyGainAnalysis(ctx);
+		return -1;
+	}
+
+	*album_gain = GetAlbumGainCtx(ctx);
+	if (settings->loudness) {
+		album_loudness[0] = GetAlbumLoudnessCtx(ctx, &range);
+		album_loudness[1] = range;
+	}
+	DestroyGainAnalysis(ctx);
+	return 0;
+}
+
+
+/* How the samples of a file are turned into output samples, see convert_samples() */
+typedef struct gain_params {
+	const SETTINGS *settings;
+	int            format;		/* Output format */
+	int            samplesize;	/* Output bits per sample */
+	int            channels;
+	double         scale;
+	double         *dc_offset;	/* DC offset to remove, or NULL */
+	double         wrap_prev_pos;
+	double         wrap_prev_neg;
+} gain_params;
+
+/* One range of a file to write on a worker thread, see write_ranges() */
+typedef struct range_job {
+	const char        *filename;
+	const char        *tempName;
+	const audio_file  *aufile;
+	const gain_params *params;
+	unsigned long     start;
+	unsigned long     end;
+	int               result;
+} range_job;
+
+
+/* Remove the DC offset, scale, limit, dither and clip samples in place.
+ * dither must be seeded as explained for APPLY_RANGE_SAMPLES.
+ */
+
+static void convert_samples(const gain_params *gp, dither_t *dither, double **pcm, int samples)
+{
+	const SETTINGS *settings = gp->settings;
+	int            j,
+	               i = 0,
+	               k;
+
+	/* scale doubles to 8, 16, 24 or 32 bit signed ints 
+	 * (host order) (unless float output)
+	 * and apply ReplayGain scaling, etc. 
+	 */
+	for(k = 0; k < gp->channels; k++) {
+		for(j = 0; j < samples; j++, i++) {
+			Int64_t val;
+			double Sum;
+
+			if (gp->dc_offset)
+				pcm[k][j] -= gp->dc_offset[k];
+
+			pcm[k][j] *= gp->scale;
+			if (settings->limiter) {	/* hard 6dB limiting */
+				if (pcm[k][j] < -0.5)
+					pcm[k][j] = tanh((pcm[k][j] + 0.5) / (1-0.5)) * (1-0.5) - 0.5;
+				else if (pcm[k][j] > 0.5)
+					pcm[k][j] = tanh((pcm[k][j] - 0.5) / (1-0.5)) * (1-0.5) + 0.5;
+			}
+			if (gp->format != WAV_FMT_FLOAT) {
+				Sum = pcm[k][j]*2147483647.f;
+				if (i > 31)
+					i = 0;
+				val = dither_output(dither, settings->dithering, settings->shapingtype, i,
+						    Sum, k, gp->format);
+				if (val > (Int64_t)gp->wrap_prev_pos)
+					val = (Int64_t)gp->wrap_prev_pos;
+				else if (val < (Int64_t)gp->wrap_prev_neg)
+					val = (Int64_t)gp->wrap_prev_neg;
+				pcm[k][j] = (double)val;
+			}
+			else {
+				if (pcm[k][j] > gp->wrap_prev_pos)
+					pcm[k][j] = gp->wrap_prev_pos;
+				else if (pcm[k][j] < gp->wrap_prev_neg)
+					pcm[k][j] = gp->wrap_prev_neg;
+			}
+		}
+	}
+}
+
+
+/* Convert and write samples, already read into pcm */
+
+static void write_samples(const gain_params *gp, dither_t *dither, audio_file *aufile,
+                          double **pcm, int samples)
+{
+	void *sample_buffer = malloc(sizeof(double) * gp->channels * samples);
+
+	convert_samples(gp, dither, pcm, samples);
+	sample_buffer = output_to_PCM(pcm, sample_buffer, gp->channels, samples, gp->format);
+	/* write to file */
+	write_audio_file(aufile, sample_buffer, samples * gp->channels);
+
+	free(sample_buffer);
+}
 
-	settings->album_peak = settings->album_peak < peak ? peak : settings->album_peak;
-	*track_peak = new_peak;
-	result = 1;
+
+/* Add the samples just read to the overall progress, and show it now and then */
+
+static void update_progress(const SETTINGS *settings, const wavegain_opt *wg_opts,
+                            double total_read, long readcount)
+{
+	lock_shared();
+	total_files += readcount;
+	if( (long)total_read % 4 == 0) {
+		/* With several files being written, "this file" would be
+		 * whichever happens to print, so only show the total */
+		if (settings->threads > 1 && !settings->std_out) {
+			if (!wg_opts->undo)
+				fprintf(stderr, "All files %3.0lf%% done\r", 
+					total_files / total_samples * 100);
+		}
+		else if (wg_opts->undo)
+			fprintf(stderr, "This file %3.0lf%% done\r", 
+				total_read / (wg_opts->total_samples_per_channel / wg_opts->rate) * 100);
+		else
+			fprintf(stderr, "This file %3.0lf%% done\tAll files %3.0lf%% done\r", 
+				total_read / (wg_opts->total_samples_per_channel / wg_opts->rate) * 100,
+				total_files / total_samples * 100);
+	}
+	unlock_shared();
+}
+
+
+/* Write one range of a file, reading it and writing the output on streams
+ * of its own.
+ */
+
+static void write_range(void *arg, int worker __attribute__((unused)))
+{
+	range_job         *job = (range_job *) arg;
+	const gain_params *gp = job->params;
+	wavegain_opt      *wg_opts = calloc(1, sizeof(wavegain_opt));
+	FILE              *infile = fopen(job->filename, "rb");
+	input_format      *format = NULL;
+	audio_file        *aufile = NULL;
+	double            *pcm[MAX_CHANNELS] = {NULL};
+	dither_t          dither;
+	unsigned long     pos = job->start;
+	double            total_read = 0.;
+	long              readcount;
+	int               i;
+
+	if (wg_opts == NULL || infile == NULL) {
+		fprintf(stderr, " Not able to open input file %s.\n", job->filename);
+		goto exit;
+	}
+	wg_opts->undo = gp->settings->undo;
+	format = open_audio_file(infile, wg_opts);
+	if (!format || !wg_opts->seek_samples || wg_opts->seek_samples(wg_opts->readdata, pos) != 0) {
+		fprintf(stderr, " Not able to seek in input file %s.\n", job->filename);
+		goto exit;
+	}
+	if ((aufile = open_output_audio_range(job->tempName, job->aufile, pos)) == NULL) {
+		fprintf(stderr, " Not able to open output file %s.\n", job->tempName);
+		goto exit;
+	}
+	for (i = 0; i < gp->channels; i++)
+		if ((pcm[i] = malloc(BUFFER_LEN * sizeof(double))) == NULL)
+			goto exit;
+
+	Init_Dither (&dither, gp->samplesize, gp->settings->shapingtype);
+	Seed_Dither (&dither, pos / APPLY_RANGE_SAMPLES);
+
+	while (pos < job->end) {
+		readcount = wg_opts->read_samples(wg_opts->readdata, pcm,
+		                                  job->end - pos < BUFFER_LEN ? (int)(job->end - pos) : BUFFER_LEN, 0, 0);
+		if (readcount <= 0)
+			break;
+
+		total_read += ((double)readcount / wg_opts->rate);
+		update_progress(gp->settings, wg_opts, total_read, readcount);
+
+		write_samples(gp, &dither, aufile, pcm, readcount);
+		pos += readcount;
+	}
+
+	if (pos == job->end)
+		job->result = 1;
+	else
+		fprintf(stderr, " Input file %s is shorter than its header says.\n", job->filename);
 
 exit:
-	if (result)
+	for (i = 0; i < MAX_CHANNELS; i++)
+		if (pcm[i]) free(pcm[i]);
+	if (aufile)
+		close_output_audio_range(aufile);
+	if (format)
 		format->close_func(wg_opts->readdata);
 	if (wg_opts)
 		free(wg_opts);
 	if (infile)
 		fclose(infile);
+}
+
+
+/* Write the data of a file in ranges of APPLY_RANGE_SAMPLES, on up to threads
+ * threads. Each range is read from filename and written to its place in
+ * tempName, whose header aufile has already written. The output is the same
+ * as when written in one go.
+ *
+ * Returns 1 if successful, or 0 (a message has been printed).
+ */
+
+static int write_ranges(const char *filename, const char *tempName, audio_file *aufile,
+                        const wavegain_opt *wg_opts, const gain_params *gp, int threads)
+{
+	unsigned long total = wg_opts->total_samples_per_channel;
+	int           nranges = (total + APPLY_RANGE_SAMPLES - 1) / APPLY_RANGE_SAMPLES;
+	range_job     *jobs = calloc(nranges, sizeof(*jobs));
+	int           result = 1,
+	              i;
+
+	if (jobs == NULL) {
+		fprintf(stderr, " Error allocating memory for output ranges\n");
+		return 0;
+	}
+
+	fflush(aufile->sndfile);
+	for (i = 0; i < nranges; i++) {
+		jobs[i].filename = filename;
+		jobs[i].tempName = tempName;
+		jobs[i].aufile = aufile;
+		jobs[i].params = gp;
+		jobs[i].start = (unsigned long)i * APPLY_RANGE_SAMPLES;
+		jobs[i].end = (i == nranges - 1) ? total : jobs[i].start + APPLY_RANGE_SAMPLES;
+	}
+
+	run_jobs(threads, jobs, nranges, sizeof(*jobs), write_range, NULL);
+
+	for (i = 0; i < nranges; i++)
+		if (!jobs[i].result)
+			result = 0;
+	end_output_audio_ranges(aufile, total);
+
+	free(jobs);
 	return result;
 }
 
@@ -381,10 +1650,15 @@ exit:
 /* Use the ReplayGain calculations to adjust the gain on the wave file.
  * If audiophile_gain is selected, that value is used, otherwise the
  * radio_gain value is used.
+ *
+ * Each call has its own dither state and buffers, so several files may be
+ * written at once from different threads. Messages, the log and the overall
+ * progress are updated under lock_shared(). Long files are written in ranges
+ * on up to threads threads, see write_ranges().
  */
 int write_gains(const char *filename, double radio_gain, double audiophile_gain,
                 double TitlePeak __attribute__((unused)),
-                double *dc_offset, double *album_dc_offset, SETTINGS *settings)
+                double *dc_offset, double *album_dc_offset, SETTINGS *settings, int threads)
 {
 	wavegain_opt *wg_opts = malloc(sizeof(wavegain_opt));
 	FILE         *infile;
@@ -397,8 +1671,10 @@ int write_gains(const char *filename, double radio_gain, double audiophile_gain,
 	double       total_read = 0.;
 	double       wrap_prev_pos = 0;
 	double       wrap_prev_neg = 0;
-	void         *sample_buffer;
+	unsigned long samples_done = 0;
 	input_format *format;
+	dither_t     dither;
+	gain_params  gp;
 
 	char         template[] = ".tmp_XXXXXX";
 	int          tempSize = strlen(filename) + strlen(template) + 1;
@@ -437,10 +1713,12 @@ int write_gains(const char *filename, double radio_gain, double audiophile_gain,
 		if (wg_opts)
 			free(wg_opts);
 		fclose(infile);
+		lock_shared();
 		fprintf(stderr, " Skipping file: %s - 'gain' chunk not found.\n", filename);
 		if (write_to_log) {
 			write_log(" Skipping file: %s - 'gain' chunk not found.\n", filename);
 		}
+		unlock_shared();
 		result = 1;
 	}
 	else if (wg_opts->gain_scale == 1.0 && !wg_opts->force) {
@@ -448,10 +1726,12 @@ int write_gains(const char *filename, double radio_gain, double audiophile_gain,
 		if (wg_opts)
 			free(wg_opts);
 		fclose(infile);
+		lock_shared();
 		fprintf(stderr, " Skipping file: %s - Gain already undone.\n", filename);
 		if (write_to_log) {
 			write_log(" Skipping file: %s - Gain already undone.\n", filename);
 		}
+		unlock_shared();
 		result = 1;
 	}
 	else {
@@ -549,8 +1829,6 @@ int write_gains(const char *filename, double radio_gain, double audiophile_gain,
 			goto exit;
 		}
 
-		Init_Dither (wg_opts->samplesize, settings->shapingtype);
-
 		if (wg_opts->undo) {
 			scale = 1.0 / wg_opts->gain_scale;
 		        Gain = 20. * log10(scale);
@@ -566,27 +1844,42 @@ int write_gains(const char *filename, double radio_gain, double audiophile_gain,
 			wg_opts->gain_scale = scale;
 		}
 
+		gp.settings = settings;
+		gp.format = wg_opts->format;
+		gp.samplesize = wg_opts->samplesize;
+		gp.channels = wg_opts->channels;
+		gp.scale = scale;
+		gp.dc_offset = settings->no_offset ? NULL : (settings->adc ? album_dc_offset : dc_offset);
+		gp.wrap_prev_pos = wrap_prev_pos;
+		gp.wrap_prev_neg = wrap_prev_neg;
+
+		lock_shared();
 		fprintf(stderr, "                                             \r");
 		fprintf(stderr, " Applying Gain of %+5.2lf dB to file: %s\n", Gain, filename);
 		if (write_to_log) {
 			write_log(" Applying Gain of %+5.2lf dB to file: %s\n", Gain, filename);
 		}
-
-		while (1) {
+		unlock_shared();
+
+		if (threads > 1 && !settings->std_out && wg_opts->seek_samples
+		    && wg_opts->total_samples_per_channel > APPLY_RANGE_SAMPLES) {
+			if (!write_ranges(filename, tempName, aufile, wg_opts, &gp, threads)) {
+				for (i = 0; i < wg_opts->channels; i++)
+					if (pcm[i]) free(pcm[i]);
+				if (pcm) free(pcm);
+				format->close_func(wg_opts->readdata);
+				close_audio_file(infile, aufile, wg_opts);
+				fclose(infile);
+				remove(tempName);
+				goto exit;
+			}
+		}
+		else while (1) {
 
 			readcount = wg_opts->read_samples(wg_opts->readdata, pcm, BUFFER_LEN, 0, 0);
 
 			total_read += ((double)readcount / wg_opts->rate);
-			total_files += ((double)readcount / wg_opts->rate);
-			if( (long)total_files % 4 == 0) {
-				if (wg_opts->undo)
-					fprintf(stderr, "This file %3.0lf%% done\r", 
-						total_read / (wg_opts->total_samples_per_channel / wg_opts->rate) * 100);
-				else
-					fprintf(stderr, "This file %3.0lf%% done\tAll files %3.0lf%% done\r", 
-						total_read / (wg_opts->total_samples_per_channel / wg_opts->rate) * 100,
-						total_files / (total_samples / wg_opts->rate) * 100);
-			}
+			update_progress(settings, wg_opts, total_read, readcount);
 
 			if (readcount == 0) {
 				break;
@@ -597,62 +1890,13 @@ int write_gains(const char *filename, double radio_gain, double audiophile_gain,
 				 */
 			} 
 			else {
-				int   convsize = BUFFER_LEN;
-				int   j,
-				      i = 0,
-				      k;
-				int   bout = (readcount < convsize ? readcount : convsize);
-
-				/* scale doubles to 8, 16, 24 or 32 bit signed ints 
-				 * (host order) (unless float output)
-				 * and apply ReplayGain scaling, etc. 
-				 */
-				sample_buffer = malloc(sizeof(double) * wg_opts->channels * bout);
-				for(k = 0; k < wg_opts->channels; k++) {
-					for(j = 0; j < bout; j++, i++) {
-						Int64_t val;
-						double Sum;
-
-						if (!settings->no_offset) {
-							if (settings->adc)
-								pcm[k][j] -= album_dc_offset[k];
-							else
-								pcm[k][j] -= dc_offset[k];
-						}
-
-						pcm[k][j] *= scale;
-						if (settings->limiter) {	/* hard 6dB limiting */
-							if (pcm[k][j] < -0.5)
-								pcm[k][j] = tanh((pcm[k][j] + 0.5) / (1-0.5)) * (1-0.5) - 0.5;
-							else if (pcm[k][j] > 0.5)
-								pcm[k][j] = tanh((pcm[k][j] - 0.5) / (1-0.5)) * (1-0.5) + 0.5;
-						}
-						if (wg_opts->format != WAV_FMT_FLOAT) {
-							Sum = pcm[k][j]*2147483647.f;
-							if (i > 31)
-								i = 0;
-							val = dither_output(settings->dithering, settings->shapingtype, i,
-									    Sum, k, wg_opts->format);
-							if (val > (Int64_t)wrap_prev_pos)
-								val = (Int64_t)wrap_prev_pos;
-							else if (val < (Int64_t)wrap_prev_neg)
-								val = (Int64_t)wrap_prev_neg;
-							pcm[k][j] = (double)val;
-						}
-						else {
-							if (pcm[k][j] > wrap_prev_pos)
-								pcm[k][j] = wrap_prev_pos;
-							else if (pcm[k][j] < wrap_prev_neg)
-								pcm[k][j] = wrap_prev_neg;
-						}
-					}
+				/* Same dither sequences as write_ranges() */
+				if (samples_done % APPLY_RANGE_SAMPLES == 0) {
+					Init_Dither (&dither, wg_opts->samplesize, settings->shapingtype);
+					Seed_Dither (&dither, samples_done / APPLY_RANGE_SAMPLES);
 				}
-				sample_buffer = output_to_PCM(pcm, sample_buffer, wg_opts->channels,
-						bout, wg_opts->format);
-				/* write to file */
-				write_audio_file(aufile, sample_buffer, bout * wg_opts->channels);
-
-				free(sample_buffer);
+				write_samples(&gp, &dither, aufile, pcm, readcount);
+				samples_done += readcount;
 			}
 		}
 		for (i = 0; i < wg_opts->channels; i++)
@@ -2,14 +2,20 @@
 #define WAVEGAIN_H
 
 #include "main.h"
+#include "gain_analysis.h"
 
 #define NO_PEAK -1.f
 #define NO_GAIN -10000.f
 
-extern int get_gain(const char *filename, double *track_peak, double *track_gain, double *dc_offset, double *offset,
-	SETTINGS *settings);
+extern int analyze_gain(FILE_LIST *file, gain_analysis_t *ctx, const SETTINGS *settings, int threads);
+extern int analyze_gains(FILE_LIST **files, gain_analysis_t **ctx, int count, const SETTINGS *settings,
+	int *results);
+extern void report_gain(FILE_LIST *file, SETTINGS *settings);
+extern int monitor_gain(FILE_LIST *file, const SETTINGS *settings);
+extern int merge_histograms(FILE_LIST *file_list, SETTINGS *settings, double *album_gain,
+	double *album_loudness);
 extern int write_gains(const char *filename, double radio_gain, double audiophile_gain, double TitlePeak,
-	double *dc_offset, double *album_dc_offset, SETTINGS *settings);
+	double *dc_offset, double *album_dc_offset, SETTINGS *settings, int threads);
 
 #endif /* WAVEGAIN_H */
 